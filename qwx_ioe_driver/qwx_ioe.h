@@ -0,0 +1,136 @@
+/* Copyright 2021, Esteban Volentini - Facet UNT, FiUBA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QWX_IOE_H
+#define QWX_IOE_H
+
+/** @file qwx_ioe.h
+ **
+ ** @brief Interfaz de usuario del driver para la placa QWXIOE
+ **
+ ** Definiciones compartidas entre el controlador y las aplicaciones de usuario para acceder a
+ ** las funciones de la placa que no se pueden representar como lectura o escritura de texto.
+ **
+ ** @addtogroup plataforma
+ ** @{
+ */
+
+/* === Inclusiones de cabeceras ================================================================ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* === Definiciones y Macros =================================================================== */
+
+//! Numero magico de los comandos ioctl del controlador
+#define QWXIOE_IOCTL_MAGIC  'q'
+
+//! Comando para leer el estado de todas las salidas de la placa
+#define QWXIOE_GET_OUTPUTS  _IOR(QWXIOE_IOCTL_MAGIC, 0x01, struct qwxioe_outputs)
+
+//! Comando para cambiar simultaneamente el estado de varias salidas de la placa
+#define QWXIOE_SET_OUTPUTS  _IOW(QWXIOE_IOCTL_MAGIC, 0x02, struct qwxioe_outputs)
+
+//! Comando para activar la salida del archivo durante la cantidad de milisegundos indicada
+#define QWXIOE_PULSE_OUTPUT _IOW(QWXIOE_IOCTL_MAGIC, 0x03, __u32)
+
+//! Comando para seleccionar el formato de los eventos leidos desde el archivo de una lectora
+#define QWXIOE_SET_FORMAT   _IO(QWXIOE_IOCTL_MAGIC, 0x04)
+
+//! Comando para obtener la ultima tarjeta leida por la lectora sin consumir eventos
+#define QWXIOE_GET_LAST     _IOR(QWXIOE_IOCTL_MAGIC, 0x05, struct qwxioe_event)
+
+//! Comando para registrar un eventfd que se señala con cada evento nuevo, -1 lo quita. El registro
+//! se quita al cerrar el archivo que lo hizo y mientras exista otro archivo recibe EBUSY
+#define QWXIOE_SET_EVENTFD  _IOW(QWXIOE_IOCTL_MAGIC, 0x06, __s32)
+
+//! Comando para activar la salida del archivo con un pulso en respuesta a un evento de lectora
+#define QWXIOE_PULSE_EVENT  _IOW(QWXIOE_IOCTL_MAGIC, 0x07, struct qwxioe_pulse)
+
+//! Formato de texto con un numero de tarjeta por lectura, es el formato por defecto
+#define QWXIOE_FORMAT_TEXT      0
+
+//! Formato binario con uno o mas registros struct qwxioe_event por lectura
+#define QWXIOE_FORMAT_BINARY    1
+
+//! Cantidad de eventos del anillo compartido de cada lectora, es potencia de dos
+#define QWXIOE_RING_EVENTS      128
+
+/* === Declaraciones de tipos de datos publicos ================================================ */
+
+//! Estructura con el estado de un conjunto de salidas, el bit N corresponde a la salida sN
+struct qwxioe_outputs {
+    __u32 mask;     //!< Salidas afectadas por el comando
+    __u32 state;    //!< Estado de las salidas seleccionadas en la mascara
+};
+
+//! Estructura con un pulso sobre una salida que responde a un evento de lectora de la misma placa
+struct qwxioe_pulse {
+    __u32 duration;     //!< Duracion del pulso en milisegundos, cero usa el valor por defecto
+    __u32 reader;       //!< Numero de la lectora que genero el evento
+    __u32 sequence;     //!< Numero de secuencia del evento en la lectora
+};
+
+//! Estructura con un evento de lectura de tarjeta en el formato binario
+struct qwxioe_event {
+    __u64 timestamp;    //!< Instante de deteccion en nanosegundos del reloj monotonico
+    __u32 sequence;     //!< Numero de secuencia del evento en la lectora
+    __u32 card_number;  //!< Numero de tarjeta decodificado de la trama
+    __u8 frame[8];      //!< Trama completa recibida desde la lectora
+    __u8 reader;        //!< Numero de la lectora que genero el evento
+    __u8 access;        //!< Resultado del control de acceso: 0 sin control, 1 autorizado, 2 rechazado
+    __u16 reserved;     //!< Reservado para uso futuro, siempre en cero
+    __u32 lost;         //!< Cantidad de eventos descartados en la lectora desde el evento leido anterior
+};
+
+/**
+ * @brief Anillo de eventos compartido por mmap con el archivo de una lectora
+ *
+ * El controlador es el unico que escribe head y los eventos, la aplicacion es la unica que
+ * escribe tail. Ambos indices crecen sin limite y se enmascaran con QWXIOE_RING_EVENTS - 1
+ * para acceder al arreglo. El anillo esta vacio cuando head es igual a tail.
+ *
+ * Para proyectar el anillo la lectora se debe abrir con O_RDWR y mmap se debe llamar con
+ * PROT_READ | PROT_WRITE y MAP_SHARED, de lo contrario la llamada falla con EINVAL.
+ */
+struct qwxioe_ring {
+    __u32 head;         //!< Indice del proximo evento que escribira el controlador
+    __u32 tail;         //!< Indice del proximo evento que leera la aplicacion
+    __u32 dropped;      //!< Cantidad de eventos descartados por estar el anillo lleno
+    __u8 reserved[52];  //!< Relleno para separar los indices de los eventos
+    struct qwxioe_event events[QWXIOE_RING_EVENTS];
+};
+
+/* === Ciere de documentacion ================================================================== */
+
+/** @} Final de la definición del modulo para doxygen */
+
+#endif /* QWX_IOE_H */
@@ -48,49 +48,553 @@
 /* === Inclusiones de cabeceras ================================================================ */
 
 #include <linux/module.h>
-#include <linux/miscdevice.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
 #include <linux/i2c.h>
 #include <linux/fs.h>
 #include <linux/of.h>
 #include <linux/uaccess.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/hashtable.h>
+#include <linux/rculist.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/interrupt.h>
+#include <linux/regmap.h>
+#include <linux/idr.h>
+#include <linux/completion.h>
+#include <linux/list.h>
+#include <linux/seqlock.h>
+#include <linux/eventfd.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/kref.h>
+#include "qwx_ioe.h"
+
+#define CREATE_TRACE_POINTS
+#include "qwx_ioe_trace.h"
 
 /* === Definiciones y Macros =================================================================== */
 
 #define OUTPUTS_COUNT   3
 
+//! Direccion del primer registro del bloque con el estado de las salidas
+#define OUTPUTS_ADDRESS     0x70
+
+//! Comando para desactivar una salida
+#define OUTPUT_OFF_COMMAND  0x70
+
+//! Comando para activar una salida
+#define OUTPUT_ON_COMMAND   0x71
+
+//! Duracion en milisegundos por defecto del pulso de una salida
+#define OUTPUT_PULSE_DURATION   2000
+
+//! Periodo en milisegundos con el que se reintenta el apagado fallido al final de un pulso
+#define OUTPUT_PULSE_RETRY      100
+
 #define READERS_COUNT   2
 
+//! Cantidad de bytes de la trama de una lectora de tarjetas
+#define READER_FRAME_SIZE   8
+
+//! Direccion del primer registro del bloque contiguo de tramas de las lectoras
+#define READERS_ADDRESS     0x10
+
+//! Direccion del registro con la trama de una lectora
+#define READER_ADDRESS(reader) (READERS_ADDRESS + READER_FRAME_SIZE * (reader))
+
+//! Cantidad de eventos que se pueden encolar en cada lectora, debe ser potencia de dos
+#define READER_EVENTS_COUNT 16
+
+//! Ventana en milisegundos por defecto para descartar lecturas repetidas de una tarjeta
+#define READER_DEDUP_WINDOW 1000
+
+//! Tiempo maximo en milisegundos que espera el productor con la politica de bloqueo
+#define READER_BLOCK_TIMEOUT    1000
+
+//! Cantidad de intervalos de los histogramas de latencia, cada uno duplica al anterior
+#define LATENCY_BUCKETS     20
+
+//! Cantidad de eventos recientes de cada lectora que se recuerdan para medir la actuacion
+#define READER_HISTORY_COUNT    32
+
+//! Longitud maxima de la linea de texto de un evento de lectura de tarjeta
+#define READER_LINE_SIZE    40
+
+//! Cantidad maxima de placas de expansion, cada una reserva un bloque de minors consecutivos
+#define BOARDS_COUNT        128
+
+//! Cantidad de minors de cada placa, primero las salidas y luego las lectoras
+#define CHANNELS_COUNT      (OUTPUTS_COUNT + READERS_COUNT)
+
+//! Numero de dispositivo del canal de una placa dentro de la region reservada por el controlador
+#define CHANNEL_DEVT(board, channel) \
+    MKDEV(MAJOR(devices_base), MINOR(devices_base) + (board) * CHANNELS_COUNT + (channel))
+
+//! Cantidad de bits del indice de la tabla de tarjetas autorizadas
+#define ACCESS_TABLE_BITS   8
+
 /* === Declaraciones de tipos de datos internos ================================================ */
 
+struct expansion_dev;
+
+//! Operaciones sobre el bus con histograma de latencia
+enum bus_operation {
+    OPERATION_READERS = 0,      //!< Lectura de las tramas de las lectoras
+    OPERATION_OUTPUT_READ,      //!< Lectura del estado de las salidas
+    OPERATION_OUTPUT_WRITE,     //!< Escritura de comandos sobre las salidas
+    OPERATIONS_COUNT,
+};
+
+//! Estructura con los contadores de transacciones de una placa en el bus
+struct bus_statistics {
+    atomic64_t reads;
+    atomic64_t writes;
+    atomic64_t naks;
+    atomic64_t timeouts;
+    atomic64_t errors;
+    atomic64_t bytes;
+    atomic64_t rejected;
+    atomic64_t congested;
+    atomic64_t trips;
+    atomic64_t latency[OPERATIONS_COUNT][LATENCY_BUCKETS];
+};
+
+//! Estructura con el eventfd registrado por la aplicacion para recibir avisos de un dispositivo
+struct event_notify {
+    spinlock_t lock;
+    struct eventfd_ctx *eventfd;
+    struct file *owner;
+};
+
+//! Prioridad de una transaccion en el planificador del bus I2C
+enum bus_priority {
+    BUS_URGENT = 0,     //!< Escritura de salidas y lecturas de lectoras con actividad reciente
+    BUS_BACKGROUND,     //!< Verificacion de salidas y consultas de lectoras sin actividad
+    BUS_PRIORITIES,
+};
+
+//! Estructura con una transaccion en espera de acceso al bus I2C
+struct bus_request {
+    struct list_head node;
+    struct completion granted;
+};
+
+//! Estructura con el planificador de transacciones de todas las placas en un adaptador I2C
+struct bus_scheduler {
+    struct list_head node;
+    struct i2c_adapter *adapter;
+    uint users;
+    spinlock_t lock;
+    bool busy;
+    struct list_head queues[BUS_PRIORITIES];
+    uint depth[BUS_PRIORITIES];
+    uint max_depth[BUS_PRIORITIES];
+    u64 transactions[BUS_PRIORITIES];
+    u64 wait_total[BUS_PRIORITIES];
+    u64 wait_max[BUS_PRIORITIES];
+};
+
+//! Estructura con la informacion de una salida digital de la placa de expansion
+struct output_dev {
+    struct device *dev;
+    struct expansion_dev *device;
+    unsigned short int number;
+    struct delayed_work pulse;
+    uint pulse_duration;
+    bool pulse_active;
+    unsigned long pulse_deadline;
+    struct event_notify notify;
+    atomic64_t actuation[LATENCY_BUCKETS];
+};
+
+//! Estructura con el instante de deteccion de un evento reciente de una lectora
+struct reader_history {
+    uint sequence;
+    ktime_t timestamp;
+};
+
+//! Resultado del control de acceso aplicado a una tarjeta leida
+enum access_result {
+    ACCESS_UNCHECKED = 0,   //!< El control de acceso en el controlador esta deshabilitado
+    ACCESS_GRANTED,         //!< La tarjeta esta autorizada en la salida asociada a la lectora
+    ACCESS_DENIED,          //!< La tarjeta no esta autorizada en la salida asociada a la lectora
+};
+
+//! Politica cuando la cola de eventos de una lectora esta llena
+enum overflow_policy {
+    OVERFLOW_DROP_OLDEST = 0,   //!< Se descarta el evento mas antiguo de la cola
+    OVERFLOW_DROP_NEWEST,       //!< Se descarta el evento nuevo
+    OVERFLOW_BLOCK,             //!< El productor espera hasta que haya lugar en la cola
+};
+
+//! Estructura con una tarjeta de la lista de acceso y las salidas que puede activar
+struct access_entry {
+    struct hlist_node node;
+    struct rcu_head rcu;
+    uint card_number;
+    unsigned long outputs;
+};
+
+//! Estructura con la informacion de un evento de lectura de tarjeta
+struct reader_event {
+    unsigned char frame[READER_FRAME_SIZE];
+    uint card_number;
+    enum access_result access;
+    uint sequence;
+    uint lost;
+    ktime_t timestamp;
+};
+
+//! Estructura con la informacion de una lectora de tarjetas de la placa de expansion
+struct reader_dev {
+    struct device *dev;
+    struct expansion_dev *device;
+    unsigned short int number;
+    int output;
+    uint sequence;
+    struct qwxioe_ring *ring;
+    __u32 ring_head;
+    atomic_t mappings;
+    seqlock_t last_lock;
+    struct reader_event last;
+    uint dedup_window;
+    uint seen_card;
+    ktime_t seen_time;
+    atomic_long_t suppressed;
+    enum overflow_policy overflow;
+    atomic_long_t dropped;
+    uint lost;
+    spinlock_t lock;
+    wait_queue_head_t wait;
+    wait_queue_head_t space;
+    struct event_notify notify;
+    struct reader_history history[READER_HISTORY_COUNT];
+    DECLARE_KFIFO(events, struct reader_event, READER_EVENTS_COUNT);
+};
+
+//! Estructura con el estado de cada archivo abierto sobre una lectora de tarjetas
+struct reader_file {
+    struct reader_dev *reader;
+    uint format;
+    struct mutex lock;
+    char line[READER_LINE_SIZE];
+    size_t offset;
+    size_t length;
+    struct reader_event pending;
+    bool held;
+};
+
 //! Estructura con la informacion del dispositivo correspondiente a la placa de expansion
 struct expansion_dev {
     struct i2c_client *client;
-    struct miscdevice outputs[OUTPUTS_COUNT];
-    struct miscdevice readers[READERS_COUNT];
+    struct bus_scheduler *scheduler;
+    struct regmap *map;
+    struct output_dev outputs[OUTPUTS_COUNT];
+    struct reader_dev readers[READERS_COUNT];
+    struct cdev *outputs_cdev;
+    struct cdev *readers_cdev;
+    struct kref refs;
+    bool removed;
+    struct delayed_work poller;
+    uint poll_delay;
+    int irq;
+    struct delayed_work verifier;
+    struct mutex lock;
+    unsigned long outputs_state;
+    bool outputs_readback;
+    uint verify_interval;
+    bool access_control;
+    struct mutex access_lock;
+    DECLARE_HASHTABLE(access_table, ACCESS_TABLE_BITS);
+    struct bus_statistics statistics;
+    atomic_t bus_failures;
+    atomic_t bus_down;
+    struct delayed_work recovery;
+    struct dentry *debugfs;
     char name[I2C_NAME_SIZE];
     int device;
 };
 
 /* === Declaraciones de funciones internas ===================================================== */
 
+static struct bus_scheduler *bus_scheduler_get(struct i2c_adapter *adapter);
+
+static void bus_scheduler_put(void *data);
+
+static int bus_acquire(struct bus_scheduler *scheduler, enum bus_priority priority);
+
+static void bus_release(struct bus_scheduler *scheduler);
+
+static int bus_exchange(struct expansion_dev *device, struct i2c_msg *messages, int count, enum bus_priority priority);
+
+static void bus_breaker(struct expansion_dev *device, int result);
+
+static void recovery_work(struct work_struct *work);
+
+static int bus_transfer(struct expansion_dev *device, struct i2c_msg *messages, int count, enum bus_priority priority);
+
+static int registers_read(struct expansion_dev *device, unsigned char address, void *data, size_t size,
+    enum bus_priority priority);
+
+static int latency_bucket(u64 microseconds);
+
+static void statistics_record(struct expansion_dev *device, enum bus_operation operation, int result,
+    size_t length, s64 duration);
+
+static int statistics_show(struct seq_file *file, void *data);
+
+static int latency_show(struct seq_file *file, void *data);
+
+static int actuation_show(struct seq_file *file, void *data);
+
+static int access_show(struct seq_file *file, void *data);
+
+static void actuation_record(struct output_dev *output, ktime_t detected, int reader, uint sequence);
+
+static void notify_init(struct event_notify *notify);
+
+static int notify_set(struct event_notify *notify, struct file *file, int fd);
+
+static void notify_signal(struct event_notify *notify);
+
+static int registers_bus_read(void *context, const void *reg, size_t reg_size, void *data, size_t size);
+
+static int registers_bus_write(void *context, const void *data, size_t count);
+
+static bool register_readable(struct device *dev, unsigned int reg);
+
+static bool register_writeable(struct device *dev, unsigned int reg);
+
+static bool register_volatile(struct device *dev, unsigned int reg);
+
+static bool register_precious(struct device *dev, unsigned int reg);
+
+static int output_fetch(struct expansion_dev *device, unsigned short int output, bool report);
+
+static int outputs_write(struct expansion_dev *device, unsigned long mask, unsigned long state, bool changed);
+
+static int outputs_apply(struct expansion_dev *device, unsigned long mask, unsigned long state);
+
+static void verifier_work(struct work_struct *work);
+
+static int output_pulse(struct output_dev *output, uint duration);
+
+static void pulse_work(struct work_struct *work);
+
+static int output_open(struct inode *inode, struct file *file);
+
+static int output_release(struct inode *inode, struct file *file);
+
 static ssize_t output_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos);
 
 static ssize_t output_write(struct file *file, const char __user *buffer, size_t len, loff_t *f_pos);
 
+static long output_ioctl(struct file *file, unsigned int command, unsigned long argument);
+
+static int reader_open(struct inode *inode, struct file *file);
+
+static int reader_release(struct inode *inode, struct file *file);
+
+static bool reader_take(struct reader_dev *reader, struct reader_event *event);
+
+static int reader_wait(struct reader_dev *reader, struct file *file, struct reader_event *event);
+
+static void reader_record(struct reader_dev *reader, const struct reader_event *event, struct qwxioe_event *record);
+
+static ssize_t reader_read_binary(struct reader_file *client, struct file *file, char __user *buffer, size_t count);
+
 static ssize_t reader_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos);
 
+static long reader_ioctl(struct file *file, unsigned int command, unsigned long argument);
+
+static void reader_vm_open(struct vm_area_struct *vma);
+
+static void reader_vm_close(struct vm_area_struct *vma);
+
+static int reader_mmap(struct file *file, struct vm_area_struct *vma);
+
+static bool ring_empty(struct reader_dev *reader);
+
+static void ring_push(struct reader_dev *reader, const struct reader_event *event);
+
+static __poll_t reader_poll(struct file *file, poll_table *wait);
+
+static struct access_entry *access_find(struct expansion_dev *device, uint card_number);
+
+static enum access_result reader_access(struct reader_dev *reader, const struct reader_event *event);
+
+static bool reader_detected(struct reader_dev *reader, uint sequence, ktime_t *timestamp);
+
+static void reader_last(struct reader_dev *reader, struct reader_event *event);
+
+static void reader_queue(struct reader_dev *reader, struct reader_event *event);
+
+static bool reader_push(struct reader_dev *reader, const unsigned char *frame);
+
+static bool reader_fetch(struct reader_dev *reader, bool *failed);
+
+static bool readers_fetch(struct expansion_dev *device, bool *failed);
+
+static bool readers_poll(struct expansion_dev *device, bool *failed);
+
+static void poller_work(struct work_struct *work);
+
+static irqreturn_t irq_handler(int irq, void *data);
+
+static ssize_t outputs_readback_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t outputs_readback_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t verify_interval_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t verify_interval_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t bus_statistics_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t access_control_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t access_control_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t access_list_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t access_list_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t bound_output_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t bound_output_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t last_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t dedup_window_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t dedup_window_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t suppressed_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t overflow_policy_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t overflow_policy_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static ssize_t dropped_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t pulse_duration_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t pulse_duration_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+static void output_init(struct expansion_dev *device, unsigned short int output_number);
+
+static int reader_init(struct expansion_dev *device, unsigned short int reader_number);
+
+static void channels_destroy(struct expansion_dev *device, int count);
+
+static int board_number(struct expansion_dev *device);
+
+static void board_release(void *data);
+
+static struct expansion_dev *board_get(struct inode *inode);
+
+static void board_free(struct kref *refs);
+
+static void board_put(struct expansion_dev *device);
+
+static void board_drop(void *data);
+
+static void board_unpublish(void *data);
+
 static int probe(struct i2c_client *client, const struct i2c_device_id *id);
 
 static int remove(struct i2c_client * client);
 
 /* === Definiciones de variables internas ====================================================== */
 
+//! Periodo minimo en milisegundos con el que se consultan las lectoras luego de una lectura
+static uint poll_min_interval = 5;
+
+//! Periodo maximo en milisegundos con el que se consultan las lectoras sin actividad
+static uint poll_max_interval = 200;
+
+//! Factor por el que se multiplica el periodo de consulta en cada consulta sin actividad
+static uint poll_backoff = 2;
+
+//! Indica si las tramas de todas las lectoras se obtienen con una unica lectura en rafaga
+static bool burst_read = true;
+
+//! Tiempo maximo en milisegundos que una transaccion espera su turno en el bus, cero no tiene limite
+static uint bus_timeout = 100;
+
+//! Cantidad de fallas consecutivas en el bus que marcan la placa como caida, cero lo deshabilita
+static uint breaker_threshold = 5;
+
+//! Periodo en milisegundos con el que se prueba la comunicacion con una placa caida
+static uint breaker_probe_interval = 1000;
+
+//! Numeros asignados a las placas de expansion para los nombres de sus dispositivos
+static DEFINE_IDA(boards_ida);
+
+//! Primer numero de dispositivo de la region con los minors de todas las placas
+static dev_t devices_base;
+
+//! Clase de los dispositivos de las salidas y lectoras de las placas
+static struct class *devices_class;
+
+//! Placas registradas indexadas por su numero, para encontrarlas al abrir un dispositivo
+static struct expansion_dev *boards[BOARDS_COUNT];
+
+//! Exclusion mutua para la tabla de placas registradas
+static DEFINE_MUTEX(boards_lock);
+
+//! Directorio raiz en debugfs con las estadisticas de todas las placas
+static struct dentry *debugfs_root;
+
+//! Nombres de las politicas cuando la cola de eventos de una lectora esta llena
+static const char * const overflow_policies[] = {
+    [OVERFLOW_DROP_OLDEST] = "drop-oldest",
+    [OVERFLOW_DROP_NEWEST] = "drop-newest",
+    [OVERFLOW_BLOCK] = "block",
+};
+
+//! Lista de planificadores de los adaptadores I2C que tienen placas de expansion
+static LIST_HEAD(bus_schedulers);
+
+//! Exclusion mutua para la lista de planificadores de los adaptadores I2C
+static DEFINE_MUTEX(bus_schedulers_lock);
+
 /* === Definiciones de variables externas ====================================================== */
 
 MODULE_AUTHOR("Esteban Volentini <evolentini@gmail.com>");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Controlador de disposativo para la placa de expansión");
 
+module_param(poll_min_interval, uint, 0644);
+MODULE_PARM_DESC(poll_min_interval, "Periodo de consulta de las lectoras luego de una lectura en milisegundos");
+
+module_param(poll_max_interval, uint, 0644);
+MODULE_PARM_DESC(poll_max_interval, "Periodo de consulta de las lectoras sin actividad en milisegundos");
+
+module_param(poll_backoff, uint, 0644);
+MODULE_PARM_DESC(poll_backoff, "Factor de incremento del periodo de consulta sin actividad");
+
+module_param(burst_read, bool, 0644);
+MODULE_PARM_DESC(burst_read, "Leer el bloque de todas las lectoras en una sola transaccion");
+
+module_param(bus_timeout, uint, 0644);
+MODULE_PARM_DESC(bus_timeout, "Tiempo maximo de espera por el bus de cada transaccion en milisegundos");
+
+module_param(breaker_threshold, uint, 0644);
+MODULE_PARM_DESC(breaker_threshold, "Fallas consecutivas en el bus para considerar caida una placa");
+
+module_param(breaker_probe_interval, uint, 0644);
+MODULE_PARM_DESC(breaker_probe_interval, "Periodo de prueba de la comunicacion con una placa caida en milisegundos");
+
 //! Arreglo con la lista de identificadores de dispositivos compatibles con el controlador
 static const struct of_device_id compatibles_devices_id[] = {
     { .compatible = "equiser,qwxioe", },
@@ -111,182 +615,2017 @@ static struct i2c_driver device_driver = {
     },
 };
 
+//! Estructura con el acceso a los registros de la placa a traves del bus I2C
+static const struct regmap_bus registers_bus = {
+    .read = registers_bus_read,
+    .write = registers_bus_write,
+};
+
+//! Estructura con la descripcion del mapa de registros de la placa
+static const struct regmap_config registers_config = {
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = OUTPUTS_ADDRESS + OUTPUTS_COUNT - 1,
+    .readable_reg = register_readable,
+    .writeable_reg = register_writeable,
+    .volatile_reg = register_volatile,
+    .precious_reg = register_precious,
+    .cache_type = REGCACHE_RBTREE,
+    // Las escrituras llegan siempre como pares de registro y valor, incluso las de varias salidas
+    .can_multi_write = true,
+    .use_single_write = true,
+};
+
 //! Estructura con la implementacion las operaciones de archivos en salidas digitales
 static const struct file_operations outputs_fops = {
     .owner = THIS_MODULE,
+    .open = output_open,
+    .release = output_release,
     .read = output_read,
     .write = output_write,
+    .unlocked_ioctl = output_ioctl,
 };
 
 //! Estructura con la implementacion las operaciones de archivos en lectoras de rfid
 static const struct file_operations readers_fops = {
     .owner = THIS_MODULE,
+    .open = reader_open,
+    .release = reader_release,
     .read = reader_read,
+    .poll = reader_poll,
+    .unlocked_ioctl = reader_ioctl,
+    .mmap = reader_mmap,
 };
 
-/* === Definiciones de funciones internas ====================================================== */
+//! Estructura con las operaciones sobre las proyecciones en memoria del anillo de eventos
+static const struct vm_operations_struct readers_vm_ops = {
+    .open = reader_vm_open,
+    .close = reader_vm_close,
+};
 
-static ssize_t output_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos)  {  
-    unsigned short int output = file->f_path.dentry->d_name.name[1] - '0';
-    struct expansion_dev * device = container_of(file->private_data, struct expansion_dev, outputs[output]);
-    char data[3] = "0\n";
-    char address, response;
+//! Atributo para forzar la lectura del estado de las salidas desde la placa
+static DEVICE_ATTR_RW(outputs_readback);
 
-    if (*f_pos == 0) {
-        address = 0x70 + output;
-        i2c_master_send(device->client, &address, sizeof(address));
+//! Atributo con el periodo de verificacion del estado de las salidas
+static DEVICE_ATTR_RW(verify_interval);
 
-        i2c_master_recv(device->client, &response, sizeof(response));
-        data[0] += response;
+//! Atributo con las estadisticas del planificador del bus I2C de la placa
+static DEVICE_ATTR_RO(bus_statistics);
 
-        count = sizeof(data);
-        if (copy_to_user(buffer, data, count)) {
-            return -EFAULT;
-        }
+//! Atributo para habilitar el control de acceso en el controlador
+static DEVICE_ATTR_RW(access_control);
 
-        *f_pos += count;
-        return count;
-    }
-    return 0;
-}
+//! Atributo con la lista de tarjetas autorizadas y las salidas que pueden activar, la lectura se
+//! limita a una pagina y la lista completa se obtiene del archivo access_list en debugfs
+static DEVICE_ATTR_RW(access_list);
 
-static ssize_t output_write(struct file *file, const char __user *buffer, size_t len, loff_t *f_pos)  {    
-    unsigned short int output = file->f_path.dentry->d_name.name[1] - '0';
-    struct expansion_dev * device = container_of(file->private_data, struct expansion_dev, outputs[output]);
-    char data[2];
-    char response;
-    
-    if (len == 0) {
-        return 0;
-    }
-    if (copy_from_user(&response, buffer, 1)) {
-        return -EFAULT;
-    }
+//! Atributo con la salida que se activa cuando una lectora recibe una tarjeta autorizada
+static DEVICE_ATTR_RW(bound_output);
 
-    if (response == '1') {
-        data[0] = 0x71;
-    } else {
-        data[0] = 0x70;
-    }
+//! Atributo con la ultima tarjeta leida por una lectora
+static DEVICE_ATTR_RO(last);
 
-    data[1] = output;
-    i2c_master_send(device->client, data, 2);
+//! Atributo con la ventana en milisegundos en la que se descartan las lecturas repetidas
+static DEVICE_ATTR_RW(dedup_window);
 
-    return len;
-}
+//! Atributo con la cantidad de lecturas repetidas descartadas por una lectora
+static DEVICE_ATTR_RO(suppressed);
 
-static ssize_t reader_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos)  {  
-    unsigned short int reader = file->f_path.dentry->d_name.name[1] - '0';
-    struct expansion_dev * device = container_of(file->private_data, struct expansion_dev, readers[reader]);
-    char address, response[8];
-    uint card_number;
-    char data[12];
+//! Atributo con la politica cuando la cola de eventos de una lectora esta llena
+static DEVICE_ATTR_RW(overflow_policy);
 
-    if (*f_pos == 0) {
-        address = 0x10 + 0x08 * reader;
-        i2c_master_send(device->client, &address, 1);
+//! Atributo con la cantidad de eventos perdidos por una lectora con la cola llena
+static DEVICE_ATTR_RO(dropped);
 
-        memset(data, 0, sizeof(response));
-        i2c_master_recv(device->client, response, sizeof(response));
-        card_number = ((uint)response[2] << 16) + ((uint)response[1] << 8) + response[0];
-        snprintf(data, sizeof(data), "%d\n", card_number);
+//! Arreglo con los atributos de configuracion de una lectora de tarjetas
+static struct attribute *reader_attrs[] = {
+    &dev_attr_bound_output.attr,
+    &dev_attr_last.attr,
+    &dev_attr_dedup_window.attr,
+    &dev_attr_suppressed.attr,
+    &dev_attr_overflow_policy.attr,
+    &dev_attr_dropped.attr,
+    NULL,
+};
 
-        count = sizeof(data);
-        if (copy_to_user(buffer, data, count)) {
-            return -EFAULT;
-        }
+//! Grupos con los atributos de configuracion de una lectora de tarjetas
+ATTRIBUTE_GROUPS(reader);
 
-        *f_pos += count;
-        return count;
-    }
-    return 0;
-}
+//! Atributo con la duracion por defecto del pulso de una salida
+static DEVICE_ATTR_RW(pulse_duration);
 
-int add_output(struct expansion_dev *device, unsigned short int output_number) {
-    struct miscdevice *output = &device->outputs[output_number];
-    char *name;
+//! Arreglo con los atributos de configuracion de una salida digital
+static struct attribute *output_attrs[] = {
+    &dev_attr_pulse_duration.attr,
+    NULL,
+};
 
-    name = devm_kzalloc(&device->client->dev, I2C_NAME_SIZE, GFP_KERNEL);
-    snprintf(name, I2C_NAME_SIZE, "%s/s%d", device->name, output_number);
-    output->name = name;
-    output->minor = MISC_DYNAMIC_MINOR;
-    output->fops = &outputs_fops;
+//! Grupos con los atributos de configuracion de una salida digital
+ATTRIBUTE_GROUPS(output);
 
-    return misc_register(output);
-}
+//! Arreglo con los atributos de configuracion de la placa de expansion
+static struct attribute *device_attributes[] = {
+    &dev_attr_outputs_readback.attr,
+    &dev_attr_verify_interval.attr,
+    &dev_attr_access_control.attr,
+    &dev_attr_access_list.attr,
+    &dev_attr_bus_statistics.attr,
+    NULL,
+};
 
-int add_reader(struct expansion_dev *device, unsigned short int reader_number) {
-    struct miscdevice *reader = &device->readers[reader_number];
-    char *name;
+//! Grupo con los atributos de configuracion de la placa de expansion
+static const struct attribute_group device_group = {
+    .attrs = device_attributes,
+};
+
+/* === Definiciones de funciones internas ====================================================== */
+
+static struct bus_scheduler *bus_scheduler_get(struct i2c_adapter *adapter) {
+    struct bus_scheduler *scheduler;
+    int priority;
 
-    name = devm_kzalloc(&device->client->dev, I2C_NAME_SIZE, GFP_KERNEL);
-    snprintf(name, I2C_NAME_SIZE, "%s/w%d", device->name, reader_number);
-    reader->name = name;
-    reader->minor = MISC_DYNAMIC_MINOR;
-    reader->fops = &readers_fops;
+    mutex_lock(&bus_schedulers_lock);
+    list_for_each_entry(scheduler, &bus_schedulers, node) {
+        if (scheduler->adapter == adapter) {
+            scheduler->users++;
+            mutex_unlock(&bus_schedulers_lock);
+            return scheduler;
+        }
+    }
 
-    return misc_register(reader);
+    scheduler = kzalloc(sizeof(*scheduler), GFP_KERNEL);
+    if (scheduler) {
+        scheduler->adapter = adapter;
+        scheduler->users = 1;
+        spin_lock_init(&scheduler->lock);
+        for(priority = 0; priority < BUS_PRIORITIES; priority++) {
+            INIT_LIST_HEAD(&scheduler->queues[priority]);
+        }
+        list_add(&scheduler->node, &bus_schedulers);
+    }
+    mutex_unlock(&bus_schedulers_lock);
+    return scheduler;
 }
 
-static int probe(struct i2c_client *client, const struct i2c_device_id *id)  {
-    struct expansion_dev *device;
-    int error, output, reader, index;
+static void bus_scheduler_put(void *data) {
+    struct bus_scheduler *scheduler = data;
 
-    if (client->addr == 0x50) {
-        device = devm_kzalloc(&client->dev, sizeof(struct expansion_dev), GFP_KERNEL);
-        snprintf(device->name, I2C_NAME_SIZE, "/exp0");
-    } else {
-        pr_err("No se reconoce la direccion del dispositivo");
-        return error;
+    mutex_lock(&bus_schedulers_lock);
+    if (--scheduler->users == 0) {
+        list_del(&scheduler->node);
+        kfree(scheduler);
     }
-    device->client = client;
-    i2c_set_clientdata(client, device);
+    mutex_unlock(&bus_schedulers_lock);
+}
 
-    for(output = 0; output < OUTPUTS_COUNT; output++) {
-        error = add_output(device, output);
-        if (error != 0) {
-            pr_err("No se pudo registrar el dispositivo %s/s%d", device->name, output);
-            for(index = 0; index < output; index++) {
-                misc_deregister(&device->outputs[index]);
-            }
-            return error;
+static int bus_acquire(struct bus_scheduler *scheduler, enum bus_priority priority) {
+    struct bus_request request;
+    uint timeout = READ_ONCE(bus_timeout);
+    ktime_t start = ktime_get();
+    u64 wait;
+
+    spin_lock(&scheduler->lock);
+    if (scheduler->busy) {
+        // Cada placa tiene a lo sumo una transaccion en espera, por lo que el orden de llegada
+        // dentro de cada prioridad reparte el bus en forma equitativa entre las placas
+        init_completion(&request.granted);
+        list_add_tail(&request.node, &scheduler->queues[priority]);
+        scheduler->depth[priority]++;
+        scheduler->max_depth[priority] = max(scheduler->max_depth[priority], scheduler->depth[priority]);
+        spin_unlock(&scheduler->lock);
+
+        if (timeout == 0) {
+            wait_for_completion(&request.granted);
+        } else {
+            wait_for_completion_timeout(&request.granted, msecs_to_jiffies(timeout));
+        }
+        spin_lock(&scheduler->lock);
+        // Si el bus no fue entregado a tiempo la transaccion se retira de la cola, con un codigo
+        // distinto al de la transferencia porque la demora es de otra placa del mismo adaptador
+        if (!list_empty(&request.node)) {
+            list_del(&request.node);
+            scheduler->depth[priority]--;
+            spin_unlock(&scheduler->lock);
+            return -EBUSY;
         }
     }
+    scheduler->busy = true;
+    wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+    scheduler->transactions[priority]++;
+    scheduler->wait_total[priority] += wait;
+    scheduler->wait_max[priority] = max(scheduler->wait_max[priority], wait);
+    spin_unlock(&scheduler->lock);
+    return 0;
+}
 
-    for(reader = 0; reader < READERS_COUNT; reader++) {
-        error = add_reader(device, reader);
-        if (error != 0) {
-            pr_err("No se pudo registrar el dispositivo %s/w%d", device->name, output);
-            for(index = 0; index < reader; index++) {
-                misc_deregister(&device->readers[index]);
-            }
-            for(output = 0; output < OUTPUTS_COUNT; output++) {
-                misc_deregister(&device->outputs[output]);
-            }
-            return error;
+static void bus_release(struct bus_scheduler *scheduler) {
+    struct bus_request *request;
+    int priority;
+
+    // El bus se entrega directamente a la primera transaccion en espera de mayor prioridad
+    spin_lock(&scheduler->lock);
+    for(priority = 0; priority < BUS_PRIORITIES; priority++) {
+        request = list_first_entry_or_null(&scheduler->queues[priority], struct bus_request, node);
+        if (request) {
+            list_del_init(&request->node);
+            scheduler->depth[priority]--;
+            complete(&request->granted);
+            spin_unlock(&scheduler->lock);
+            return;
         }
     }
+    scheduler->busy = false;
+    spin_unlock(&scheduler->lock);
+}
 
-    return 0;
+static int bus_exchange(struct expansion_dev *device, struct i2c_msg *messages, int count, enum bus_priority priority) {
+    int result;
+
+    result = bus_acquire(device->scheduler, priority);
+    if (result) {
+        return result;
+    }
+    result = i2c_transfer(device->client->adapter, messages, count);
+    bus_release(device->scheduler);
+
+    if (result < 0) {
+        return result;
+    }
+    return (result == count) ? 0 : -EIO;
 }
 
-static int remove(struct i2c_client * client)  {
-    struct expansion_dev *device = i2c_get_clientdata(client);
-    int output, reader;
+static void bus_breaker(struct expansion_dev *device, int result) {
+    uint threshold = READ_ONCE(breaker_threshold);
+    int reader;
 
-    for(output = 0; output < OUTPUTS_COUNT; output++) {
-        misc_deregister(&device->outputs[output]);
+    // Solo cuentan los resultados de la transferencia, no la espera por el bus compartido
+    if (result == -EBUSY) {
+        return;
     }
-    for(reader = 0; reader < READERS_COUNT; reader++) {
-        misc_deregister(&device->readers[reader]);
+    if (result == 0) {
+        atomic_set(&device->bus_failures, 0);
+        return;
+    }
+    if ((threshold == 0) || (atomic_inc_return(&device->bus_failures) < threshold)) {
+        return;
     }
 
-    return 0;
+    if (atomic_xchg(&device->bus_down, 1) == 0) {
+        dev_warn(&device->client->dev, "La placa no responde luego de %u fallas, se suspende el acceso al bus", threshold);
+        atomic64_inc(&device->statistics.trips);
+        // Las aplicaciones que esperan tarjetas se despiertan para informarles la falla
+        for(reader = 0; reader < READERS_COUNT; reader++) {
+            wake_up_interruptible(&device->readers[reader].wait);
+        }
+        schedule_delayed_work(&device->recovery, msecs_to_jiffies(READ_ONCE(breaker_probe_interval)));
+    }
+}
+
+static void recovery_work(struct work_struct *work) {
+    struct expansion_dev *device = container_of(to_delayed_work(work), struct expansion_dev, recovery);
+    unsigned char address = OUTPUTS_ADDRESS;
+    unsigned char states[OUTPUTS_COUNT];
+    struct i2c_msg messages[] = {
+        { .addr = device->client->addr, .flags = 0, .len = sizeof(address), .buf = &address },
+        { .addr = device->client->addr, .flags = I2C_M_RD, .len = sizeof(states), .buf = states },
+    };
+    int output;
+
+    // La prueba lee el bloque de salidas sin pasar por el corte, que sigue rechazando al resto
+    if (bus_exchange(device, messages, ARRAY_SIZE(messages), BUS_BACKGROUND)) {
+        schedule_delayed_work(&device->recovery, msecs_to_jiffies(READ_ONCE(breaker_probe_interval)));
+        return;
+    }
+
+    // Las salidas pudieron cambiar sin comunicacion, por lo que el estado guardado se reemplaza
+    // por el leido en la prueba antes de volver a aceptar transacciones
+    mutex_lock(&device->lock);
+    regcache_drop_region(device->map, OUTPUTS_ADDRESS, OUTPUTS_ADDRESS + OUTPUTS_COUNT - 1);
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        if (test_bit(output, &device->outputs_state) != (states[output] != 0)) {
+            assign_bit(output, &device->outputs_state, states[output] != 0);
+            trace_qwxioe_output(device->device, output, states[output] != 0);
+            notify_signal(&device->outputs[output].notify);
+        }
+    }
+
+    atomic_set(&device->bus_failures, 0);
+    atomic_set(&device->bus_down, 0);
+
+    // Los pulsos que vencieron sin comunicacion se apagan antes de liberar la exclusion, para que
+    // ninguna otra operacion sobre las salidas vea la placa disponible con un apagado pendiente
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        if (device->outputs[output].pulse_active && time_after_eq(jiffies, device->outputs[output].pulse_deadline) &&
+            (outputs_apply(device, BIT(output), 0) == 0)) {
+            device->outputs[output].pulse_active = false;
+        }
+    }
+
+    // Las interrupciones recibidas con la placa caida no pudieron leer las lectoras
+    if (device->irq && !device->removed) {
+        mod_delayed_work(system_wq, &device->poller, 0);
+    }
+    mutex_unlock(&device->lock);
+    dev_info(&device->client->dev, "La placa responde nuevamente, se reanuda el acceso al bus");
+}
+
+static int bus_transfer(struct expansion_dev *device, struct i2c_msg *messages, int count, enum bus_priority priority) {
+    int result;
+
+    // Con la placa caida las transacciones fallan de inmediato sin esperar el bus
+    if (atomic_read(&device->bus_down)) {
+        return -EHOSTDOWN;
+    }
+    result = bus_exchange(device, messages, count, priority);
+    bus_breaker(device, result);
+    return result;
+}
+
+static int registers_read(struct expansion_dev *device, unsigned char address, void *data, size_t size,
+    enum bus_priority priority) {
+    struct i2c_msg messages[] = {
+        { .addr = device->client->addr, .flags = 0, .len = sizeof(address), .buf = &address },
+        { .addr = device->client->addr, .flags = I2C_M_RD, .len = size, .buf = data },
+    };
+    ktime_t start = ktime_get();
+    s64 duration;
+    int result;
+
+    // Escritura de la direccion y lectura de los datos con un inicio repetido en una sola transaccion
+    result = bus_transfer(device, messages, ARRAY_SIZE(messages), priority);
+    duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+    trace_qwxioe_register_read(device->device, address, size, result, duration);
+    statistics_record(device, (address < OUTPUTS_ADDRESS) ? OPERATION_READERS : OPERATION_OUTPUT_READ, result,
+        size, duration);
+    return result;
+}
+
+static int registers_bus_read(void *context, const void *reg, size_t reg_size, void *data, size_t size) {
+    struct expansion_dev *device = context;
+    unsigned char address = *(const unsigned char *) reg;
+    enum bus_priority priority = BUS_BACKGROUND;
+
+    // Las lectoras son urgentes cuando las pide la interrupcion o hubo una tarjeta reciente
+    if ((address < OUTPUTS_ADDRESS) && (device->irq || (device->poll_delay <= READ_ONCE(poll_min_interval)))) {
+        priority = BUS_URGENT;
+    }
+    return registers_read(device, address, data, size, priority);
+}
+
+static int registers_bus_write(void *context, const void *data, size_t count) {
+    struct expansion_dev *device = context;
+    const unsigned char *pairs = data;
+    struct i2c_msg messages[OUTPUTS_COUNT];
+    unsigned char commands[OUTPUTS_COUNT][2];
+    unsigned short int number;
+    ktime_t start = ktime_get();
+    s64 duration;
+    int output, result;
+
+    // La placa no tiene registros de escritura, cada par de registro y valor en el bloque de salidas
+    // se traduce a una trama de encendido o apagado y se envian todas en una sola transaccion
+    if ((count == 0) || (count % 2) || (count / 2 > OUTPUTS_COUNT)) {
+        return -EINVAL;
+    }
+    count = count / 2;
+    for(output = 0; output < count; output++) {
+        number = pairs[2 * output] - OUTPUTS_ADDRESS;
+        if (number >= OUTPUTS_COUNT) {
+            return -EINVAL;
+        }
+        commands[output][0] = pairs[2 * output + 1] ? OUTPUT_ON_COMMAND : OUTPUT_OFF_COMMAND;
+        commands[output][1] = number;
+        messages[output].addr = device->client->addr;
+        messages[output].flags = 0;
+        messages[output].len = sizeof(commands[output]);
+        messages[output].buf = commands[output];
+    }
+
+    result = bus_transfer(device, messages, count, BUS_URGENT);
+    duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+    trace_qwxioe_register_write(device->device, pairs[0], count, result, duration);
+    statistics_record(device, OPERATION_OUTPUT_WRITE, result, count * sizeof(commands[0]), duration);
+    return result;
+}
+
+static bool register_readable(struct device *dev, unsigned int reg) {
+    return ((reg >= READERS_ADDRESS) && (reg < READER_ADDRESS(READERS_COUNT))) ||
+        ((reg >= OUTPUTS_ADDRESS) && (reg < OUTPUTS_ADDRESS + OUTPUTS_COUNT));
+}
+
+static bool register_writeable(struct device *dev, unsigned int reg) {
+    return (reg >= OUTPUTS_ADDRESS) && (reg < OUTPUTS_ADDRESS + OUTPUTS_COUNT);
+}
+
+static bool register_volatile(struct device *dev, unsigned int reg) {
+    return (reg >= READERS_ADDRESS) && (reg < READER_ADDRESS(READERS_COUNT));
+}
+
+static bool register_precious(struct device *dev, unsigned int reg) {
+    // Leer una trama la consume en la placa, por lo que el volcado de debugfs no debe tocarlas
+    return (reg >= READERS_ADDRESS) && (reg < READER_ADDRESS(READERS_COUNT));
+}
+
+static int latency_bucket(u64 microseconds) {
+    // El intervalo N cuenta las duraciones entre 2^(N-1) y 2^N microsegundos
+    return microseconds ? min(ilog2(microseconds) + 1, LATENCY_BUCKETS - 1) : 0;
+}
+
+static void statistics_record(struct expansion_dev *device, enum bus_operation operation, int result,
+    size_t length, s64 duration) {
+    struct bus_statistics *statistics = &device->statistics;
+    u64 microseconds = div_u64(max_t(s64, duration, 0), NSEC_PER_USEC);
+
+    // Las transacciones rechazadas con la placa caida no llegan al bus
+    if (result == -EHOSTDOWN) {
+        atomic64_inc(&statistics->rejected);
+        return;
+    }
+    if (result == -EBUSY) {
+        atomic64_inc(&statistics->congested);
+        return;
+    }
+
+    atomic64_inc((operation == OPERATION_OUTPUT_WRITE) ? &statistics->writes : &statistics->reads);
+    if (result == 0) {
+        atomic64_add(length, &statistics->bytes);
+    } else if ((result == -ENXIO) || (result == -EREMOTEIO)) {
+        atomic64_inc(&statistics->naks);
+    } else if (result == -ETIMEDOUT) {
+        atomic64_inc(&statistics->timeouts);
+    } else {
+        atomic64_inc(&statistics->errors);
+    }
+
+    atomic64_inc(&statistics->latency[operation][latency_bucket(microseconds)]);
+}
+
+static int statistics_show(struct seq_file *file, void *data) {
+    struct expansion_dev *device = file->private;
+    struct bus_statistics *statistics = &device->statistics;
+
+    seq_printf(file, "reads %lld\n", atomic64_read(&statistics->reads));
+    seq_printf(file, "writes %lld\n", atomic64_read(&statistics->writes));
+    seq_printf(file, "naks %lld\n", atomic64_read(&statistics->naks));
+    seq_printf(file, "timeouts %lld\n", atomic64_read(&statistics->timeouts));
+    seq_printf(file, "errors %lld\n", atomic64_read(&statistics->errors));
+    seq_printf(file, "bytes %lld\n", atomic64_read(&statistics->bytes));
+    seq_printf(file, "rejected %lld\n", atomic64_read(&statistics->rejected));
+    seq_printf(file, "congested %lld\n", atomic64_read(&statistics->congested));
+    seq_printf(file, "trips %lld\n", atomic64_read(&statistics->trips));
+    seq_printf(file, "state %s\n", atomic_read(&device->bus_down) ? "down" : "up");
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(statistics);
+
+static int latency_show(struct seq_file *file, void *data) {
+    struct bus_statistics *statistics = file->private;
+    static const char * const names[] = {
+        [OPERATION_READERS] = "readers",
+        [OPERATION_OUTPUT_READ] = "output_read",
+        [OPERATION_OUTPUT_WRITE] = "output_write",
+    };
+    int operation, bucket;
+
+    for(operation = 0; operation < OPERATIONS_COUNT; operation++) {
+        seq_printf(file, "%s\n", names[operation]);
+        for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            seq_printf(file, "  < %7lu us %lld\n", 1UL << bucket,
+                atomic64_read(&statistics->latency[operation][bucket]));
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+static int actuation_show(struct seq_file *file, void *data) {
+    struct expansion_dev *device = file->private;
+    int output, bucket;
+
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        seq_printf(file, "s%d\n", output);
+        for(bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            seq_printf(file, "  < %7lu us %lld\n", 1UL << bucket,
+                atomic64_read(&device->outputs[output].actuation[bucket]));
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(actuation);
+
+static int access_show(struct seq_file *file, void *data) {
+    struct expansion_dev *device = file->private;
+    struct access_entry *entry;
+    int bucket;
+
+    rcu_read_lock();
+    hash_for_each_rcu(device->access_table, bucket, entry, node) {
+        seq_printf(file, "%u 0x%lx\n", entry->card_number, entry->outputs);
+    }
+    rcu_read_unlock();
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(access);
+
+static void actuation_record(struct output_dev *output, ktime_t detected, int reader, uint sequence) {
+    s64 latency = ktime_to_ns(ktime_sub(ktime_get(), detected));
+
+    atomic64_inc(&output->actuation[latency_bucket(div_u64(max_t(s64, latency, 0), NSEC_PER_USEC))]);
+    trace_qwxioe_actuation(output->device->device, output->number, reader, sequence, latency);
+}
+
+static void notify_init(struct event_notify *notify) {
+    spin_lock_init(&notify->lock);
+    notify->eventfd = NULL;
+    notify->owner = NULL;
+}
+
+static int notify_set(struct event_notify *notify, struct file *file, int fd) {
+    struct eventfd_ctx *eventfd = NULL, *previous;
+    unsigned long flags;
+
+    // Un descriptor negativo quita el eventfd registrado
+    if (fd >= 0) {
+        eventfd = eventfd_ctx_fdget(fd);
+        if (IS_ERR(eventfd)) {
+            return PTR_ERR(eventfd);
+        }
+    }
+
+    // El registro pertenece al archivo que lo hizo y otro archivo no lo puede reemplazar ni
+    // quitar, un archivo nulo lo quita siempre al retirar la placa
+    spin_lock_irqsave(&notify->lock, flags);
+    if (file && notify->eventfd && (notify->owner != file)) {
+        spin_unlock_irqrestore(&notify->lock, flags);
+        if (eventfd) {
+            eventfd_ctx_put(eventfd);
+        }
+        return -EBUSY;
+    }
+    previous = notify->eventfd;
+    notify->eventfd = eventfd;
+    notify->owner = eventfd ? file : NULL;
+    spin_unlock_irqrestore(&notify->lock, flags);
+
+    if (previous) {
+        eventfd_ctx_put(previous);
+    }
+    return 0;
+}
+
+static void notify_signal(struct event_notify *notify) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&notify->lock, flags);
+    if (notify->eventfd) {
+        eventfd_signal(notify->eventfd, 1);
+    }
+    spin_unlock_irqrestore(&notify->lock, flags);
+}
+
+static int output_fetch(struct expansion_dev *device, unsigned short int output, bool report) {
+    unsigned int response;
+    int error;
+
+    mutex_lock(&device->lock);
+    if (device->removed) {
+        mutex_unlock(&device->lock);
+        return -ENODEV;
+    }
+    // Cuando se verifica el estado se descarta el valor guardado para forzar la lectura de la placa
+    if (report) {
+        regcache_drop_region(device->map, OUTPUTS_ADDRESS + output, OUTPUTS_ADDRESS + output);
+    }
+    error = regmap_read(device->map, OUTPUTS_ADDRESS + output, &response);
+    if (error == 0) {
+        if (report && (test_bit(output, &device->outputs_state) != (response != 0))) {
+            dev_warn(&device->client->dev, "La salida s%d fue modificada externamente", output);
+            notify_signal(&device->outputs[output].notify);
+            trace_qwxioe_output(device->device, output, response != 0);
+        }
+        assign_bit(output, &device->outputs_state, response != 0);
+    }
+    mutex_unlock(&device->lock);
+    return error;
+}
+
+static int outputs_write(struct expansion_dev *device, unsigned long mask, unsigned long state, bool changed) {
+    int output, error;
+
+    // El estado guardado se consulta y se actualiza en la misma seccion que la escritura en la
+    // placa, para que dos escrituras concurrentes no dejen un estado distinto al de las salidas
+    mutex_lock(&device->lock);
+    if (device->removed) {
+        mutex_unlock(&device->lock);
+        return -ENODEV;
+    }
+    // Un cambio explicito anula el apagado pendiente de un pulso sobre las salidas afectadas
+    for_each_set_bit(output, &mask, OUTPUTS_COUNT) {
+        device->outputs[output].pulse_active = false;
+    }
+    if (changed) {
+        mask &= state ^ device->outputs_state;
+    }
+    error = outputs_apply(device, mask, state);
+    mutex_unlock(&device->lock);
+    return error;
+}
+
+static int outputs_apply(struct expansion_dev *device, unsigned long mask, unsigned long state) {
+    struct reg_sequence sequence[OUTPUTS_COUNT];
+    int output, count = 0, error;
+
+    // Todas las salidas seleccionadas viajan en una sola transaccion aunque no sean contiguas, las
+    // salidas no seleccionadas nunca se escriben para no deshacer un cambio externo con el estado guardado
+    for_each_set_bit(output, &mask, OUTPUTS_COUNT) {
+        sequence[count].reg = OUTPUTS_ADDRESS + output;
+        sequence[count].def = test_bit(output, &state);
+        sequence[count].delay_us = 0;
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    error = regmap_multi_reg_write(device->map, sequence, count);
+    if (error) {
+        // El mapa guarda los valores antes de enviarlos, por lo que se descartan si la placa no los recibio
+        regcache_drop_region(device->map, OUTPUTS_ADDRESS, OUTPUTS_ADDRESS + OUTPUTS_COUNT - 1);
+        return error;
+    }
+
+    for_each_set_bit(output, &mask, OUTPUTS_COUNT) {
+        if (test_bit(output, &device->outputs_state) != test_bit(output, &state)) {
+            assign_bit(output, &device->outputs_state, test_bit(output, &state));
+            trace_qwxioe_output(device->device, output, test_bit(output, &state));
+            notify_signal(&device->outputs[output].notify);
+        }
+    }
+    return 0;
+}
+
+static void verifier_work(struct work_struct *work) {
+    struct expansion_dev *device = container_of(to_delayed_work(work), struct expansion_dev, verifier);
+    int output;
+
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        output_fetch(device, output, true);
+    }
+
+    // Una placa retirada no vuelve a programar la verificacion
+    mutex_lock(&device->lock);
+    if (!device->removed && device->verify_interval) {
+        schedule_delayed_work(&device->verifier, msecs_to_jiffies(device->verify_interval));
+    }
+    mutex_unlock(&device->lock);
+}
+
+static int output_pulse(struct output_dev *output, uint duration) {
+    struct expansion_dev *device = output->device;
+    int error;
+
+    if (duration == 0) {
+        duration = output->pulse_duration;
+    }
+
+    // El encendido y el plazo de apagado se fijan juntos para que un apagado en curso los respete
+    mutex_lock(&device->lock);
+    if (device->removed) {
+        mutex_unlock(&device->lock);
+        return -ENODEV;
+    }
+    error = outputs_apply(device, BIT(output->number), BIT(output->number));
+    if (error == 0) {
+        // Un nuevo pulso sobre una salida activa extiende el tiempo hasta el apagado
+        output->pulse_active = true;
+        output->pulse_deadline = jiffies + msecs_to_jiffies(duration);
+        mod_delayed_work(system_highpri_wq, &output->pulse, msecs_to_jiffies(duration));
+        trace_qwxioe_output_pulse(device->device, output->number, duration);
+    }
+    mutex_unlock(&device->lock);
+    return error;
+}
+
+static void pulse_work(struct work_struct *work) {
+    struct output_dev *output = container_of(to_delayed_work(work), struct output_dev, pulse);
+    struct expansion_dev *device = output->device;
+
+    // Solo se apaga si el pulso no fue anulado por un cambio explicito ni extendido por otro pulso
+    mutex_lock(&device->lock);
+    if (output->pulse_active && time_after_eq(jiffies, output->pulse_deadline)) {
+        if (outputs_apply(device, BIT(output->number), 0) == 0) {
+            output->pulse_active = false;
+        } else if (!device->removed) {
+            // El pulso sigue activo y el apagado se reintenta hasta que la placa responda
+            dev_err_ratelimited(&device->client->dev, "No se pudo apagar la salida s%d al final del pulso",
+                output->number);
+            mod_delayed_work(system_highpri_wq, &output->pulse, msecs_to_jiffies(OUTPUT_PULSE_RETRY));
+        } else {
+            dev_err(&device->client->dev, "No se pudo apagar la salida s%d al retirar la placa", output->number);
+        }
+    }
+    mutex_unlock(&device->lock);
+}
+
+static int output_open(struct inode *inode, struct file *file) {
+    struct expansion_dev *device = board_get(inode);
+
+    if (!device) {
+        return -ENODEV;
+    }
+    // El minor dentro del bloque de la placa indica el numero de la salida
+    file->private_data = &device->outputs[(iminor(inode) - MINOR(devices_base)) % CHANNELS_COUNT];
+    return 0;
+}
+
+static int output_release(struct inode *inode, struct file *file) {
+    struct output_dev *output = file->private_data;
+
+    // Al cerrar el archivo se quita el eventfd que haya registrado
+    notify_set(&output->notify, file, -1);
+    board_put(output->device);
+    return 0;
+}
+
+static ssize_t output_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos)  {  
+    struct output_dev *output = file->private_data;
+    struct expansion_dev *device = output->device;
+    char data[10];
+    bool stale;
+    int error;
+
+    if (*f_pos == 0) {
+        // Con la placa caida se informa el ultimo estado conocido marcado como desactualizado
+        stale = atomic_read(&device->bus_down);
+        if (device->outputs_readback && !stale) {
+            error = output_fetch(device, output->number, true);
+            if (error == -EHOSTDOWN) {
+                stale = true;
+            } else if (error) {
+                return error;
+            }
+        }
+
+        count = min(count, (size_t) scnprintf(data, sizeof(data), "%d%s\n",
+            test_bit(output->number, &device->outputs_state), stale ? " stale" : ""));
+        if (copy_to_user(buffer, data, count)) {
+            return -EFAULT;
+        }
+
+        *f_pos += count;
+        return count;
+    }
+    return 0;
+}
+
+static ssize_t output_write(struct file *file, const char __user *buffer, size_t len, loff_t *f_pos)  {    
+    struct output_dev *output = file->private_data;
+    struct expansion_dev *device = output->device;
+    char data[32];
+    char *tag;
+    uint duration = 0;
+    uint reader = READERS_COUNT, sequence;
+    ktime_t detected;
+    int result;
+    
+    if (len == 0) {
+        return 0;
+    }
+    if (copy_from_user(data, buffer, min(len, sizeof(data) - 1))) {
+        return -EFAULT;
+    }
+    data[min(len, sizeof(data) - 1)] = 0;
+
+    // Un sufijo "@R:S" indica que el comando responde al evento S de la lectora R de la placa
+    tag = strchr(data, '@');
+    if (tag) {
+        *tag = 0;
+        if ((sscanf(tag + 1, "%u:%u", &reader, &sequence) != 2) || (reader >= READERS_COUNT)) {
+            return -EINVAL;
+        }
+    }
+
+    // El comando "p" o "pN" enciende la salida y la apaga luego de N milisegundos
+    if (data[0] == 'p') {
+        if (strim(&data[1])[0] && kstrtouint(strim(&data[1]), 0, &duration)) {
+            return -EINVAL;
+        }
+        result = output_pulse(output, duration);
+    } else {
+        cancel_delayed_work(&output->pulse);
+        result = outputs_write(device, BIT(output->number), (data[0] == '1') ? BIT(output->number) : 0, false);
+    }
+    if (result < 0) {
+        return result;
+    }
+
+    if ((reader < READERS_COUNT) && reader_detected(&device->readers[reader], sequence, &detected)) {
+        actuation_record(output, detected, reader, sequence);
+    }
+    return len;
+}
+
+static long output_ioctl(struct file *file, unsigned int command, unsigned long argument) {
+    struct output_dev *output = file->private_data;
+    struct expansion_dev *device = output->device;
+    void __user *data = (void __user *) argument;
+    struct qwxioe_outputs outputs;
+    unsigned long mask;
+    struct qwxioe_pulse pulse;
+    ktime_t detected;
+    __u32 duration;
+    __s32 fd;
+    int index, error;
+
+    switch (command) {
+    case QWXIOE_GET_OUTPUTS:
+        outputs.mask = GENMASK(OUTPUTS_COUNT - 1, 0);
+        outputs.state = READ_ONCE(device->outputs_state);
+        if (copy_to_user(data, &outputs, sizeof(outputs))) {
+            return -EFAULT;
+        }
+        return 0;
+
+    case QWXIOE_SET_OUTPUTS:
+        if (copy_from_user(&outputs, data, sizeof(outputs))) {
+            return -EFAULT;
+        }
+        if (outputs.mask & ~GENMASK(OUTPUTS_COUNT - 1, 0)) {
+            return -EINVAL;
+        }
+        mask = outputs.mask;
+        for_each_set_bit(index, &mask, OUTPUTS_COUNT) {
+            cancel_delayed_work(&device->outputs[index].pulse);
+        }
+        // Solo se envian las tramas de las salidas que cambian de estado
+        return outputs_write(device, outputs.mask, outputs.state, true);
+
+    case QWXIOE_PULSE_OUTPUT:
+        if (get_user(duration, (__u32 __user *) data)) {
+            return -EFAULT;
+        }
+        return output_pulse(output, duration);
+
+    case QWXIOE_PULSE_EVENT:
+        if (copy_from_user(&pulse, data, sizeof(pulse))) {
+            return -EFAULT;
+        }
+        if (pulse.reader >= READERS_COUNT) {
+            return -EINVAL;
+        }
+        error = output_pulse(output, pulse.duration);
+        if ((error == 0) && reader_detected(&device->readers[pulse.reader], pulse.sequence, &detected)) {
+            actuation_record(output, detected, pulse.reader, pulse.sequence);
+        }
+        return error;
+
+    case QWXIOE_SET_EVENTFD:
+        if (get_user(fd, (__s32 __user *) data)) {
+            return -EFAULT;
+        }
+        return notify_set(&output->notify, file, fd);
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int reader_open(struct inode *inode, struct file *file) {
+    struct expansion_dev *device;
+    struct reader_file *client;
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client) {
+        return -ENOMEM;
+    }
+    device = board_get(inode);
+    if (!device) {
+        kfree(client);
+        return -ENODEV;
+    }
+
+    // El minor dentro del bloque de la placa indica el numero de la lectora
+    client->reader = &device->readers[(iminor(inode) - MINOR(devices_base)) % CHANNELS_COUNT - OUTPUTS_COUNT];
+    client->format = QWXIOE_FORMAT_TEXT;
+    mutex_init(&client->lock);
+    file->private_data = client;
+    return 0;
+}
+
+static int reader_release(struct inode *inode, struct file *file) {
+    struct reader_file *client = file->private_data;
+
+    // Al cerrar el archivo se quita el eventfd que haya registrado
+    notify_set(&client->reader->notify, file, -1);
+    board_put(client->reader->device);
+    kfree(client);
+    return 0;
+}
+
+static bool reader_take(struct reader_dev *reader, struct reader_event *event) {
+    unsigned long flags;
+    bool taken;
+
+    // Los eventos perdidos desde la entrega anterior se informan con el proximo evento leido,
+    // sin importar si se descarto el mas antiguo de la cola o el nuevo
+    spin_lock_irqsave(&reader->lock, flags);
+    taken = kfifo_get(&reader->events, event);
+    if (taken) {
+        event->lost = reader->lost;
+        reader->lost = 0;
+    }
+    spin_unlock_irqrestore(&reader->lock, flags);
+
+    if (taken) {
+        wake_up(&reader->space);
+    }
+    return taken;
+}
+
+static int reader_wait(struct reader_dev *reader, struct file *file, struct reader_event *event) {
+    int error;
+
+    while (!reader_take(reader, event)) {
+        // Los eventos pendientes se entregan aunque la placa este caida, pero no se espera por nuevos
+        if (READ_ONCE(reader->device->removed)) {
+            return -ENODEV;
+        }
+        if (atomic_read(&reader->device->bus_down)) {
+            return -EHOSTDOWN;
+        }
+        if (file->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+        error = wait_event_interruptible(reader->wait,
+            !kfifo_is_empty(&reader->events) || atomic_read(&reader->device->bus_down) ||
+            READ_ONCE(reader->device->removed));
+        if (error) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+static void reader_record(struct reader_dev *reader, const struct reader_event *event, struct qwxioe_event *record) {
+    memset(record, 0, sizeof(*record));
+    record->timestamp = ktime_to_ns(event->timestamp);
+    record->sequence = event->sequence;
+    record->card_number = event->card_number;
+    memcpy(record->frame, event->frame, sizeof(record->frame));
+    record->reader = reader->number;
+    record->access = event->access;
+    record->lost = event->lost;
+}
+
+static ssize_t reader_read_binary(struct reader_file *client, struct file *file, char __user *buffer, size_t count) {
+    struct reader_dev *reader = client->reader;
+    struct qwxioe_event record;
+    struct reader_event event;
+    size_t length = 0;
+    int error = 0;
+
+    if (count < sizeof(record)) {
+        return -EINVAL;
+    }
+    if (mutex_lock_interruptible(&client->lock)) {
+        return -ERESTARTSYS;
+    }
+
+    // Se espera el primer evento y luego se entregan todos los pendientes que entren en el buffer,
+    // un evento que no se pudo copiar queda guardado para la proxima lectura sobre el mismo archivo
+    if (client->held) {
+        event = client->pending;
+        client->held = false;
+    } else {
+        error = reader_wait(reader, file, &event);
+    }
+    if (error == 0) {
+        do {
+            reader_record(reader, &event, &record);
+            if (copy_to_user(buffer + length, &record, sizeof(record))) {
+                client->pending = event;
+                client->held = true;
+                error = -EFAULT;
+                break;
+            }
+            length += sizeof(record);
+        } while ((length + sizeof(record) <= count) && reader_take(reader, &event));
+    }
+    mutex_unlock(&client->lock);
+
+    return length ? length : error;
+}
+
+static ssize_t reader_read(struct file *file, char __user *buffer, size_t count, loff_t *f_pos)  {  
+    struct reader_file *client = file->private_data;
+    struct reader_dev *reader = client->reader;
+    struct reader_event event;
+    static const char * const results[] = {
+        [ACCESS_UNCHECKED] = "",
+        [ACCESS_GRANTED] = " granted",
+        [ACCESS_DENIED] = " denied",
+    };
+    size_t length = 0, size;
+    int error = 0;
+
+    if (client->format == QWXIOE_FORMAT_BINARY) {
+        return reader_read_binary(client, file, buffer, count);
+    }
+
+    // Se entregan todas las lineas pendientes que entren en el buffer, el resto de una linea
+    // que no entra completa queda guardado para la proxima lectura sobre el mismo archivo
+    if (mutex_lock_interruptible(&client->lock)) {
+        return -ERESTARTSYS;
+    }
+    while (length < count) {
+        if (client->offset == client->length) {
+            if (length == 0) {
+                error = reader_wait(reader, file, &event);
+            } else if (!reader_take(reader, &event)) {
+                break;
+            }
+            if (error) {
+                break;
+            }
+            client->length = scnprintf(client->line, sizeof(client->line), "%u%s", event.card_number,
+                results[event.access]);
+            if (event.lost) {
+                client->length += scnprintf(client->line + client->length, sizeof(client->line) - client->length,
+                    " lost %u", event.lost);
+            }
+            client->length += scnprintf(client->line + client->length, sizeof(client->line) - client->length, "\n");
+            client->offset = 0;
+        }
+
+        size = min(count - length, client->length - client->offset);
+        if (copy_to_user(buffer + length, client->line + client->offset, size)) {
+            error = -EFAULT;
+            break;
+        }
+        client->offset += size;
+        length += size;
+    }
+    mutex_unlock(&client->lock);
+
+    if (length == 0) {
+        return error;
+    }
+    *f_pos += length;
+    return length;
+}
+
+static long reader_ioctl(struct file *file, unsigned int command, unsigned long argument) {
+    struct reader_file *client = file->private_data;
+    struct qwxioe_event record;
+    struct reader_event event;
+    __s32 fd;
+
+    switch (command) {
+    case QWXIOE_SET_FORMAT:
+        if ((argument != QWXIOE_FORMAT_TEXT) && (argument != QWXIOE_FORMAT_BINARY)) {
+            return -EINVAL;
+        }
+        client->format = argument;
+        return 0;
+
+    case QWXIOE_SET_EVENTFD:
+        if (get_user(fd, (__s32 __user *) argument)) {
+            return -EFAULT;
+        }
+        return notify_set(&client->reader->notify, file, fd);
+
+    case QWXIOE_GET_LAST:
+        reader_last(client->reader, &event);
+        reader_record(client->reader, &event, &record);
+        if (copy_to_user((void __user *) argument, &record, sizeof(record))) {
+            return -EFAULT;
+        }
+        return 0;
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+static void reader_vm_open(struct vm_area_struct *vma) {
+    struct reader_dev *reader = vma->vm_private_data;
+
+    // Cada proyeccion mantiene una referencia a la placa hasta que se cierra
+    kref_get(&reader->device->refs);
+    atomic_inc(&reader->mappings);
+}
+
+static void reader_vm_close(struct vm_area_struct *vma) {
+    struct reader_dev *reader = vma->vm_private_data;
+
+    atomic_dec(&reader->mappings);
+    board_put(reader->device);
+}
+
+static int reader_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct reader_dev *reader = ((struct reader_file *) file->private_data)->reader;
+    int error;
+
+    if ((vma->vm_pgoff != 0) || (vma->vm_end - vma->vm_start > PAGE_ALIGN(sizeof(struct qwxioe_ring)))) {
+        return -EINVAL;
+    }
+    // La aplicacion debe poder avanzar el indice de lectura y el controlador verlo, por lo que la
+    // proyeccion tiene que ser compartida y de escritura
+    if ((vma->vm_flags & (VM_SHARED | VM_WRITE)) != (VM_SHARED | VM_WRITE)) {
+        return -EINVAL;
+    }
+
+    error = remap_vmalloc_range(vma, reader->ring, 0);
+    if (error) {
+        return error;
+    }
+    vma->vm_ops = &readers_vm_ops;
+    vma->vm_private_data = reader;
+    reader_vm_open(vma);
+    return 0;
+}
+
+static bool ring_empty(struct reader_dev *reader) {
+    return READ_ONCE(reader->ring_head) == READ_ONCE(reader->ring->tail);
+}
+
+static void ring_push(struct reader_dev *reader, const struct reader_event *event) {
+    struct qwxioe_ring *ring = reader->ring;
+    __u32 head = reader->ring_head;
+
+    // La aplicacion puede modificar cualquier campo del anillo, por lo que el indice de escritura
+    // se conserva en el controlador y solo se publica, y el de lectura nunca se usa sin enmascarar
+    if (head - smp_load_acquire(&ring->tail) >= QWXIOE_RING_EVENTS) {
+        WRITE_ONCE(ring->dropped, ring->dropped + 1);
+        atomic_long_inc(&reader->dropped);
+        return;
+    }
+    reader_record(reader, event, &ring->events[head & (QWXIOE_RING_EVENTS - 1)]);
+    WRITE_ONCE(reader->ring_head, head + 1);
+    smp_store_release(&ring->head, head + 1);
+}
+
+static __poll_t reader_poll(struct file *file, poll_table *wait) {
+    struct reader_file *client = file->private_data;
+    struct reader_dev *reader = client->reader;
+    __poll_t mask = 0;
+
+    poll_wait(file, &reader->wait, wait);
+    if (atomic_read(&reader->mappings)) {
+        if (!ring_empty(reader)) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+    } else if (!kfifo_is_empty(&reader->events) || (client->offset != client->length) || client->held) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (atomic_read(&reader->device->bus_down)) {
+        mask |= EPOLLERR;
+    }
+    if (READ_ONCE(reader->device->removed)) {
+        mask |= EPOLLHUP;
+    }
+    return mask;
+}
+
+static struct access_entry *access_find(struct expansion_dev *device, uint card_number) {
+    struct access_entry *entry;
+
+    // Los lectores la recorren bajo rcu_read_lock y los escritores con la exclusion de la lista
+    hash_for_each_possible_rcu(device->access_table, entry, node, card_number,
+        lockdep_is_held(&device->access_lock)) {
+        if (entry->card_number == card_number) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static enum access_result reader_access(struct reader_dev *reader, const struct reader_event *event) {
+    struct expansion_dev *device = reader->device;
+    uint card_number = event->card_number;
+    struct access_entry *entry;
+    int output = READ_ONCE(reader->output);
+    bool granted;
+
+    if (!device->access_control) {
+        return ACCESS_UNCHECKED;
+    }
+
+    rcu_read_lock();
+    entry = access_find(device, card_number);
+    granted = entry && ((output < 0) || test_bit(output, &entry->outputs));
+    rcu_read_unlock();
+
+    // La salida se activa directamente sin esperar la decision de la aplicacion
+    if (granted && (output >= 0)) {
+        if (output_pulse(&device->outputs[output], 0)) {
+            dev_err(&device->client->dev, "No se pudo activar la salida s%d para la tarjeta %u", output, card_number);
+        } else {
+            actuation_record(&device->outputs[output], event->timestamp, reader->number, event->sequence);
+        }
+    }
+    return granted ? ACCESS_GRANTED : ACCESS_DENIED;
+}
+
+static bool reader_detected(struct reader_dev *reader, uint sequence, ktime_t *timestamp) {
+    struct reader_history *history = &reader->history[sequence & (READER_HISTORY_COUNT - 1)];
+    bool found;
+
+    spin_lock(&reader->lock);
+    found = (history->sequence == sequence) && (history->timestamp != 0);
+    *timestamp = history->timestamp;
+    spin_unlock(&reader->lock);
+    return found;
+}
+
+static void reader_last(struct reader_dev *reader, struct reader_event *event) {
+    unsigned int sequence;
+
+    // La copia se repite si la lectora publico una tarjeta nueva mientras se leia
+    do {
+        sequence = read_seqbegin(&reader->last_lock);
+        *event = reader->last;
+    } while (read_seqretry(&reader->last_lock, sequence));
+}
+
+static void reader_queue(struct reader_dev *reader, struct reader_event *event) {
+    struct reader_event oldest;
+    bool stored;
+
+    if ((reader->overflow == OVERFLOW_BLOCK) && kfifo_is_full(&reader->events)) {
+        // La espera se limita para que la placa no quede sin consultar si nadie lee la cola
+        wait_event_timeout(reader->space, !kfifo_is_full(&reader->events), msecs_to_jiffies(READER_BLOCK_TIMEOUT));
+    }
+
+    // Los eventos perdidos se acumulan hasta que reader_take los informa con el proximo evento
+    spin_lock(&reader->lock);
+    if (kfifo_is_full(&reader->events) && (reader->overflow == OVERFLOW_DROP_OLDEST)) {
+        if (kfifo_get(&reader->events, &oldest)) {
+            reader->lost++;
+            atomic_long_inc(&reader->dropped);
+        }
+    }
+    stored = kfifo_put(&reader->events, *event);
+    if (!stored) {
+        reader->lost++;
+        atomic_long_inc(&reader->dropped);
+    }
+    spin_unlock(&reader->lock);
+
+    if (!stored) {
+        pr_warn_ratelimited("Se descarto la tarjeta %u en %s por falta de espacio", event->card_number, dev_name(reader->dev));
+    }
+}
+
+static bool reader_push(struct reader_dev *reader, const unsigned char *frame) {
+    struct reader_event event;
+
+    memcpy(event.frame, frame, sizeof(event.frame));
+    event.card_number = ((uint)event.frame[2] << 16) + ((uint)event.frame[1] << 8) + event.frame[0];
+    if (event.card_number == 0) {
+        return false;
+    }
+    event.timestamp = ktime_get();
+    event.lost = 0;
+
+    // Una tarjeta que se mantiene frente a la lectora se descarta mientras se siga repitiendo
+    // dentro de la ventana, sin pasar por el control de acceso ni despertar a la aplicacion
+    if ((event.card_number == reader->seen_card) &&
+        (ktime_ms_delta(event.timestamp, reader->seen_time) < READ_ONCE(reader->dedup_window))) {
+        reader->seen_time = event.timestamp;
+        atomic_long_inc(&reader->suppressed);
+        return true;
+    }
+    reader->seen_card = event.card_number;
+    reader->seen_time = event.timestamp;
+
+    event.sequence = reader->sequence++;
+    spin_lock(&reader->lock);
+    reader->history[event.sequence & (READER_HISTORY_COUNT - 1)].sequence = event.sequence;
+    reader->history[event.sequence & (READER_HISTORY_COUNT - 1)].timestamp = event.timestamp;
+    spin_unlock(&reader->lock);
+
+    event.access = reader_access(reader, &event);
+    trace_qwxioe_card(reader->device->device, reader->number, event.card_number, event.sequence, event.access);
+
+    write_seqlock(&reader->last_lock);
+    reader->last = event;
+    write_sequnlock(&reader->last_lock);
+
+    // Mientras el anillo compartido este proyectado en memoria los eventos se entregan solo por el
+    if (atomic_read(&reader->mappings)) {
+        if (ring_empty(reader)) {
+            ring_push(reader, &event);
+            wake_up_interruptible(&reader->wait);
+            notify_signal(&reader->notify);
+        } else {
+            ring_push(reader, &event);
+        }
+        return true;
+    }
+
+    reader_queue(reader, &event);
+    wake_up_interruptible(&reader->wait);
+    notify_signal(&reader->notify);
+    return true;
+}
+
+static bool reader_fetch(struct reader_dev *reader, bool *failed) {
+    unsigned char frame[READER_FRAME_SIZE];
+
+    if (regmap_raw_read(reader->device->map, READER_ADDRESS(reader->number), frame, sizeof(frame)) == 0) {
+        return reader_push(reader, frame);
+    }
+    *failed = true;
+    return false;
+}
+
+static bool readers_fetch(struct expansion_dev *device, bool *failed) {
+    unsigned char frames[READERS_COUNT][READER_FRAME_SIZE];
+    bool activity = false;
+    int reader;
+
+    if (regmap_raw_read(device->map, READERS_ADDRESS, frames, sizeof(frames)) == 0) {
+        for(reader = 0; reader < READERS_COUNT; reader++) {
+            activity |= reader_push(&device->readers[reader], frames[reader]);
+        }
+    } else {
+        *failed = true;
+    }
+    return activity;
+}
+
+static bool readers_poll(struct expansion_dev *device, bool *failed) {
+    bool activity = false;
+    int reader;
+
+    *failed = false;
+    if (burst_read) {
+        activity = readers_fetch(device, failed);
+    } else {
+        for(reader = 0; reader < READERS_COUNT; reader++) {
+            activity |= reader_fetch(&device->readers[reader], failed);
+        }
+    }
+    return activity;
+}
+
+static void poller_work(struct work_struct *work) {
+    struct expansion_dev *device = container_of(to_delayed_work(work), struct expansion_dev, poller);
+    uint min_interval = max(READ_ONCE(poll_min_interval), 1U);
+    uint max_interval = max(READ_ONCE(poll_max_interval), min_interval);
+    bool activity, failed;
+
+    activity = readers_poll(device, &failed);
+
+    // Con interrupcion la consulta solo reintenta una lectura fallida, ya que el flanco no se repite
+    if (device->irq && !failed) {
+        device->poll_delay = min_interval;
+        return;
+    }
+
+    // Luego de una lectura se consulta rapido y sin actividad el periodo crece hasta el maximo
+    if (activity) {
+        device->poll_delay = min_interval;
+    } else {
+        device->poll_delay = clamp(device->poll_delay * max(READ_ONCE(poll_backoff), 1U), min_interval, max_interval);
+    }
+    schedule_delayed_work(&device->poller, msecs_to_jiffies(device->poll_delay));
+}
+
+static irqreturn_t irq_handler(int irq, void *data) {
+    struct expansion_dev *device = data;
+    bool failed;
+
+    // La placa indica con la interrupcion que una lectora tiene una tarjeta nueva; si la lectura
+    // falla la tarjeta queda en la placa y se vuelve a buscar desde la consulta periodica
+    readers_poll(device, &failed);
+    if (failed) {
+        mod_delayed_work(system_wq, &device->poller, 0);
+    }
+    return IRQ_HANDLED;
+}
+
+static ssize_t outputs_readback_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", device->outputs_readback);
+}
+
+static ssize_t outputs_readback_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    int error;
+
+    error = kstrtobool(buf, &device->outputs_readback);
+    return error ? error : count;
+}
+
+static ssize_t verify_interval_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", device->verify_interval);
+}
+
+static ssize_t verify_interval_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    uint interval;
+    int error;
+
+    error = kstrtouint(buf, 0, &interval);
+    if (error) {
+        return error;
+    }
+
+    mutex_lock(&device->lock);
+    if (device->removed) {
+        mutex_unlock(&device->lock);
+        return -ENODEV;
+    }
+    device->verify_interval = interval;
+    if (interval) {
+        mod_delayed_work(system_wq, &device->verifier, msecs_to_jiffies(interval));
+    } else {
+        cancel_delayed_work(&device->verifier);
+    }
+    mutex_unlock(&device->lock);
+    return count;
+}
+
+static ssize_t bus_statistics_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    struct bus_scheduler *scheduler = device->scheduler;
+    static const char * const names[] = { "urgent", "background" };
+    int priority, length = 0;
+
+    spin_lock(&scheduler->lock);
+    for(priority = 0; priority < BUS_PRIORITIES; priority++) {
+        length += sysfs_emit_at(buf, length, "%s depth %u max_depth %u transactions %llu wait_avg_us %llu wait_max_us %llu\n",
+            names[priority], scheduler->depth[priority], scheduler->max_depth[priority],
+            scheduler->transactions[priority],
+            scheduler->transactions[priority] ? div64_u64(scheduler->wait_total[priority], scheduler->transactions[priority] * NSEC_PER_USEC) : 0,
+            div_u64(scheduler->wait_max[priority], NSEC_PER_USEC));
+    }
+    spin_unlock(&scheduler->lock);
+    return length;
+}
+
+static ssize_t access_control_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", device->access_control);
+}
+
+static ssize_t access_control_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    int error;
+
+    error = kstrtobool(buf, &device->access_control);
+    return error ? error : count;
+}
+
+static ssize_t access_list_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    struct access_entry *entry;
+    char line[32];
+    int bucket, size, length = 0;
+
+    // Solo se entregan lineas completas, las que no entran en la pagina se omiten
+    rcu_read_lock();
+    hash_for_each_rcu(device->access_table, bucket, entry, node) {
+        size = scnprintf(line, sizeof(line), "%u 0x%lx\n", entry->card_number, entry->outputs);
+        if (length + size >= PAGE_SIZE) {
+            break;
+        }
+        length += sysfs_emit_at(buf, length, "%s", line);
+    }
+    rcu_read_unlock();
+    return length;
+}
+
+static ssize_t access_list_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct expansion_dev *device = dev_get_drvdata(dev);
+    struct access_entry *entry, *previous;
+    struct hlist_node *next;
+    char *commands, *line, *cursor;
+    uint card_number;
+    long outputs;
+    int bucket, error = 0;
+
+    commands = kstrndup(buf, count, GFP_KERNEL);
+    if (!commands) {
+        return -ENOMEM;
+    }
+
+    // Cada linea es "tarjeta salidas" para agregar, "-tarjeta" para quitar o "clear" para vaciar
+    mutex_lock(&device->access_lock);
+    cursor = commands;
+    while (!error && (line = strsep(&cursor, "\n")) != NULL) {
+        line = strim(line);
+        if (*line == 0) {
+            continue;
+        }
+
+        if (strcmp(line, "clear") == 0) {
+            hash_for_each_safe(device->access_table, bucket, next, entry, node) {
+                hash_del_rcu(&entry->node);
+                kfree_rcu(entry, rcu);
+            }
+        } else if (*line == '-') {
+            error = kstrtouint(line + 1, 0, &card_number);
+            previous = error ? NULL : access_find(device, card_number);
+            if (previous) {
+                hash_del_rcu(&previous->node);
+                kfree_rcu(previous, rcu);
+            }
+        } else if (sscanf(line, "%u %li", &card_number, &outputs) == 2) {
+            entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+            if (!entry) {
+                error = -ENOMEM;
+                break;
+            }
+            entry->card_number = card_number;
+            entry->outputs = outputs & GENMASK(OUTPUTS_COUNT - 1, 0);
+            previous = access_find(device, card_number);
+            if (previous) {
+                hlist_replace_rcu(&previous->node, &entry->node);
+                kfree_rcu(previous, rcu);
+            } else {
+                hash_add_rcu(device->access_table, &entry->node, card_number);
+            }
+        } else {
+            error = -EINVAL;
+        }
+    }
+    mutex_unlock(&device->access_lock);
+
+    kfree(commands);
+    return error ? error : count;
+}
+
+static ssize_t bound_output_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", reader->output);
+}
+
+static ssize_t bound_output_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+    int output;
+    int error;
+
+    error = kstrtoint(buf, 0, &output);
+    if (error) {
+        return error;
+    }
+    if ((output < -1) || (output >= OUTPUTS_COUNT)) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(reader->output, output);
+    return count;
+}
+
+static ssize_t last_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+    struct reader_event event;
+
+    reader_last(reader, &event);
+    return sysfs_emit(buf, "%u %u %lld %8phN\n", event.card_number, event.sequence,
+        ktime_to_ns(event.timestamp), event.frame);
+}
+
+static ssize_t dedup_window_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", reader->dedup_window);
+}
+
+static ssize_t dedup_window_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+    uint window;
+    int error;
+
+    error = kstrtouint(buf, 0, &window);
+    if (error) {
+        return error;
+    }
+
+    WRITE_ONCE(reader->dedup_window, window);
+    return count;
+}
+
+static ssize_t suppressed_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ld\n", atomic_long_read(&reader->suppressed));
+}
+
+static ssize_t overflow_policy_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", overflow_policies[reader->overflow]);
+}
+
+static ssize_t overflow_policy_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+    int policy;
+
+    policy = sysfs_match_string(overflow_policies, buf);
+    if (policy < 0) {
+        return policy;
+    }
+
+    WRITE_ONCE(reader->overflow, policy);
+    return count;
+}
+
+static ssize_t dropped_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct reader_dev *reader = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ld\n", atomic_long_read(&reader->dropped));
+}
+
+static ssize_t pulse_duration_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct output_dev *output = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", output->pulse_duration);
+}
+
+static ssize_t pulse_duration_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct output_dev *output = dev_get_drvdata(dev);
+    uint duration;
+    int error;
+
+    error = kstrtouint(buf, 0, &duration);
+    if (error) {
+        return error;
+    }
+    if (duration == 0) {
+        return -EINVAL;
+    }
+
+    output->pulse_duration = duration;
+    return count;
+}
+
+static void output_init(struct expansion_dev *device, unsigned short int output_number) {
+    struct output_dev *output = &device->outputs[output_number];
+
+    output->device = device;
+    output->number = output_number;
+    output->pulse_duration = OUTPUT_PULSE_DURATION;
+    INIT_DELAYED_WORK(&output->pulse, pulse_work);
+    notify_init(&output->notify);
+}
+
+static int reader_init(struct expansion_dev *device, unsigned short int reader_number) {
+    struct reader_dev *reader = &device->readers[reader_number];
+
+    reader->device = device;
+    reader->number = reader_number;
+    reader->output = -1;
+    atomic_set(&reader->mappings, 0);
+    seqlock_init(&reader->last_lock);
+    reader->dedup_window = READER_DEDUP_WINDOW;
+    atomic_long_set(&reader->suppressed, 0);
+    atomic_long_set(&reader->dropped, 0);
+    reader->overflow = OVERFLOW_DROP_OLDEST;
+    reader->ring = vmalloc_user(sizeof(struct qwxioe_ring));
+    if (!reader->ring) {
+        return -ENOMEM;
+    }
+    spin_lock_init(&reader->lock);
+    init_waitqueue_head(&reader->wait);
+    init_waitqueue_head(&reader->space);
+    notify_init(&reader->notify);
+    INIT_KFIFO(reader->events);
+    return 0;
+}
+
+int add_output(struct expansion_dev *device, unsigned short int output_number) {
+    struct output_dev *output = &device->outputs[output_number];
+
+    // El signo ! en el nombre se convierte en un subdirectorio del nodo en /dev
+    output->dev = device_create_with_groups(devices_class, &device->client->dev,
+        CHANNEL_DEVT(device->device, output_number), output, output_groups, "exp%d!s%d", device->device, output_number);
+    return PTR_ERR_OR_ZERO(output->dev);
+}
+
+int add_reader(struct expansion_dev *device, unsigned short int reader_number) {
+    struct reader_dev *reader = &device->readers[reader_number];
+
+    reader->dev = device_create_with_groups(devices_class, &device->client->dev,
+        CHANNEL_DEVT(device->device, OUTPUTS_COUNT + reader_number), reader, reader_groups, "exp%d!w%d",
+        device->device, reader_number);
+    return PTR_ERR_OR_ZERO(reader->dev);
+}
+
+static void channels_destroy(struct expansion_dev *device, int count) {
+    int channel;
+
+    for(channel = 0; channel < count; channel++) {
+        device_destroy(devices_class, CHANNEL_DEVT(device->device, channel));
+    }
+}
+
+static int board_number(struct expansion_dev *device) {
+    int alias;
+
+    // Un alias expN en el arbol de dispositivos fija el numero, sino se usa el primero libre
+    alias = of_alias_get_id(device->client->dev.of_node, "exp");
+    if (alias >= BOARDS_COUNT) {
+        return -EINVAL;
+    } else if (alias >= 0) {
+        return ida_alloc_range(&boards_ida, alias, alias, GFP_KERNEL);
+    }
+
+    // Las placas sin alias se numeran despues del mayor alias para no ocupar uno reservado
+    return ida_alloc_range(&boards_ida, max(of_alias_get_highest_id("exp") + 1, 0), BOARDS_COUNT - 1, GFP_KERNEL);
+}
+
+static void board_release(void *data) {
+    struct expansion_dev *device = data;
+
+    ida_free(&boards_ida, device->device);
+}
+
+static struct expansion_dev *board_get(struct inode *inode) {
+    struct expansion_dev *device;
+
+    // Cada archivo abierto mantiene una referencia para que la placa sobreviva a su retiro
+    mutex_lock(&boards_lock);
+    device = boards[(iminor(inode) - MINOR(devices_base)) / CHANNELS_COUNT];
+    if (device) {
+        kref_get(&device->refs);
+    }
+    mutex_unlock(&boards_lock);
+    return device;
+}
+
+static void board_free(struct kref *refs) {
+    struct expansion_dev *device = container_of(refs, struct expansion_dev, refs);
+    struct access_entry *entry;
+    struct hlist_node *next;
+    int reader, bucket;
+
+    // La lista de acceso se libera con la ultima referencia, cuando ya se quitaron los atributos
+    // de sysfs y se detuvo la consulta de las lectoras, por lo que no quedan lectores ni escritores
+    hash_for_each_safe(device->access_table, bucket, next, entry, node) {
+        hash_del(&entry->node);
+        kfree(entry);
+    }
+    for(reader = 0; reader < READERS_COUNT; reader++) {
+        vfree(device->readers[reader].ring);
+    }
+    kfree(device);
+}
+
+static void board_put(struct expansion_dev *device) {
+    kref_put(&device->refs, board_free);
+}
+
+static void board_drop(void *data) {
+    board_put(data);
+}
+
+static void board_unpublish(void *data) {
+    struct expansion_dev *device = data;
+
+    mutex_lock(&boards_lock);
+    if (boards[device->device] == device) {
+        boards[device->device] = NULL;
+    }
+    mutex_unlock(&boards_lock);
+}
+
+static int probe(struct i2c_client *client, const struct i2c_device_id *id)  {
+    struct expansion_dev *device;
+    int error, output, reader;
+
+    // La placa se libera con la ultima referencia, que puede ser de un archivo abierto luego del retiro
+    device = kzalloc(sizeof(struct expansion_dev), GFP_KERNEL);
+    if (!device) {
+        return -ENOMEM;
+    }
+    kref_init(&device->refs);
+    error = devm_add_action_or_reset(&client->dev, board_drop, device);
+    if (error != 0) {
+        return error;
+    }
+    device->client = client;
+
+    device->device = board_number(device);
+    if (device->device < 0) {
+        dev_err(&client->dev, "No se pudo asignar un numero a la placa en 0x%02x", client->addr);
+        return device->device;
+    }
+    error = devm_add_action_or_reset(&client->dev, board_release, device);
+    if (error != 0) {
+        return error;
+    }
+    snprintf(device->name, I2C_NAME_SIZE, "/exp%d", device->device);
+    INIT_DELAYED_WORK(&device->poller, poller_work);
+    INIT_DELAYED_WORK(&device->verifier, verifier_work);
+    INIT_DELAYED_WORK(&device->recovery, recovery_work);
+    mutex_init(&device->lock);
+    mutex_init(&device->access_lock);
+    hash_init(device->access_table);
+    i2c_set_clientdata(client, device);
+
+    device->scheduler = bus_scheduler_get(client->adapter);
+    if (!device->scheduler) {
+        return -ENOMEM;
+    }
+    error = devm_add_action_or_reset(&client->dev, bus_scheduler_put, device->scheduler);
+    if (error != 0) {
+        return error;
+    }
+
+    device->map = devm_regmap_init(&client->dev, &registers_bus, device, &registers_config);
+    if (IS_ERR(device->map)) {
+        dev_err(&client->dev, "No se pudo crear el mapa de registros");
+        return PTR_ERR(device->map);
+    }
+
+    // Los canales quedan inicializados, con sus anillos reservados, antes de leer la placa o crear
+    // cualquier atributo o nodo; los anillos se liberan con la placa aunque la prueba falle despues
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        output_init(device, output);
+    }
+    for(reader = 0; reader < READERS_COUNT; reader++) {
+        error = reader_init(device, reader);
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        if (output_fetch(device, output, false)) {
+            dev_warn(&client->dev, "No se pudo leer el estado inicial de la salida s%d", output);
+        }
+    }
+
+    error = devm_device_add_group(&client->dev, &device_group);
+    if (error != 0) {
+        return error;
+    }
+
+    mutex_lock(&boards_lock);
+    boards[device->device] = device;
+    mutex_unlock(&boards_lock);
+    error = devm_add_action_or_reset(&client->dev, board_unpublish, device);
+    if (error != 0) {
+        return error;
+    }
+
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        error = add_output(device, output);
+        if (error != 0) {
+            pr_err("No se pudo registrar el dispositivo %s/s%d", device->name, output);
+            channels_destroy(device, output);
+            return error;
+        }
+    }
+    for(reader = 0; reader < READERS_COUNT; reader++) {
+        error = add_reader(device, reader);
+        if (error != 0) {
+            pr_err("No se pudo registrar el dispositivo %s/w%d", device->name, reader);
+            channels_destroy(device, OUTPUTS_COUNT + reader);
+            return error;
+        }
+    }
+
+    // Cada placa registra un bloque de minors para sus salidas y otro para sus lectoras, los cdev
+    // se reservan por separado porque pueden seguir referenciados por archivos abiertos. Agregarlos
+    // es el ultimo paso que expone la placa, a partir de aqui se pueden abrir los canales
+    device->outputs_cdev = cdev_alloc();
+    if (!device->outputs_cdev) {
+        channels_destroy(device, CHANNELS_COUNT);
+        return -ENOMEM;
+    }
+    device->outputs_cdev->ops = &outputs_fops;
+    device->outputs_cdev->owner = THIS_MODULE;
+    error = cdev_add(device->outputs_cdev, CHANNEL_DEVT(device->device, 0), OUTPUTS_COUNT);
+    if (error != 0) {
+        kobject_put(&device->outputs_cdev->kobj);
+        channels_destroy(device, CHANNELS_COUNT);
+        return error;
+    }
+    device->readers_cdev = cdev_alloc();
+    if (!device->readers_cdev) {
+        cdev_del(device->outputs_cdev);
+        channels_destroy(device, CHANNELS_COUNT);
+        return -ENOMEM;
+    }
+    device->readers_cdev->ops = &readers_fops;
+    device->readers_cdev->owner = THIS_MODULE;
+    error = cdev_add(device->readers_cdev, CHANNEL_DEVT(device->device, OUTPUTS_COUNT), READERS_COUNT);
+    if (error != 0) {
+        kobject_put(&device->readers_cdev->kobj);
+        cdev_del(device->outputs_cdev);
+        channels_destroy(device, CHANNELS_COUNT);
+        return error;
+    }
+
+    device->debugfs = debugfs_create_dir(device->name + 1, debugfs_root);
+    debugfs_create_file("statistics", 0444, device->debugfs, device, &statistics_fops);
+    debugfs_create_file("latency", 0444, device->debugfs, &device->statistics, &latency_fops);
+    debugfs_create_file("actuation", 0444, device->debugfs, device, &actuation_fops);
+    debugfs_create_file("access_list", 0444, device->debugfs, device, &access_fops);
+
+    // Si la placa describe una linea de interrupcion no es necesario consultar las lectoras
+    if (client->irq > 0) {
+        // El modo se fija antes de pedir la interrupcion, que puede llegar y reintentar de inmediato
+        device->irq = client->irq;
+        error = devm_request_threaded_irq(&client->dev, client->irq, NULL, irq_handler, IRQF_ONESHOT,
+            dev_name(&client->dev), device);
+        if (error) {
+            device->irq = 0;
+            dev_warn(&client->dev, "No se pudo usar la interrupcion %d, se consultan las lectoras", client->irq);
+        }
+    }
+    if (device->irq == 0) {
+        schedule_delayed_work(&device->poller, 0);
+    }
+    return 0;
+}
+
+static int remove(struct i2c_client * client)  {
+    struct expansion_dev *device = i2c_get_clientdata(client);
+    int output, reader;
+
+    if (device->irq) {
+        disable_irq(device->irq);
+    }
+
+    // Los archivos que sigan abiertos mantienen la placa, pero dejan de acceder al bus, y ni la
+    // verificacion desde sysfs ni la recuperacion del bus vuelven a programar trabajos una vez marcada
+    mutex_lock(&device->lock);
+    device->removed = true;
+    device->verify_interval = 0;
+    // Un pulso pendiente se completa en este momento para no dejar la salida activa
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        device->outputs[output].pulse_deadline = jiffies;
+    }
+    mutex_unlock(&device->lock);
+    cancel_delayed_work_sync(&device->poller);
+    debugfs_remove_recursive(device->debugfs);
+    cancel_delayed_work_sync(&device->verifier);
+
+    board_unpublish(device);
+    cdev_del(device->outputs_cdev);
+    cdev_del(device->readers_cdev);
+
+    for(output = 0; output < OUTPUTS_COUNT; output++) {
+        device_destroy(devices_class, CHANNEL_DEVT(device->device, output));
+        flush_delayed_work(&device->outputs[output].pulse);
+        notify_set(&device->outputs[output].notify, NULL, -1);
+    }
+    for(reader = 0; reader < READERS_COUNT; reader++) {
+        device_destroy(devices_class, CHANNEL_DEVT(device->device, OUTPUTS_COUNT + reader));
+        notify_set(&device->readers[reader].notify, NULL, -1);
+        wake_up_interruptible(&device->readers[reader].wait);
+    }
+    cancel_delayed_work_sync(&device->recovery);
+
+    return 0;
 }
 
 /* === Definiciones de funciones externas ====================================================== */
 
-module_i2c_driver(device_driver);
+static int __init qwx_ioe_init(void) {
+    int error;
+
+    // Se reservan de una vez los minors de todas las placas posibles
+    error = alloc_chrdev_region(&devices_base, 0, BOARDS_COUNT * CHANNELS_COUNT, "qwx_ioe");
+    if (error) {
+        return error;
+    }
+    devices_class = class_create(THIS_MODULE, "qwx_ioe");
+    if (IS_ERR(devices_class)) {
+        unregister_chrdev_region(devices_base, BOARDS_COUNT * CHANNELS_COUNT);
+        return PTR_ERR(devices_class);
+    }
+
+    debugfs_root = debugfs_create_dir("qwx_ioe", NULL);
+    error = i2c_add_driver(&device_driver);
+    if (error) {
+        debugfs_remove_recursive(debugfs_root);
+        class_destroy(devices_class);
+        unregister_chrdev_region(devices_base, BOARDS_COUNT * CHANNELS_COUNT);
+    }
+    return error;
+}
+
+static void __exit qwx_ioe_exit(void) {
+    i2c_del_driver(&device_driver);
+    debugfs_remove_recursive(debugfs_root);
+    class_destroy(devices_class);
+    unregister_chrdev_region(devices_base, BOARDS_COUNT * CHANNELS_COUNT);
+}
+
+module_init(qwx_ioe_init);
+module_exit(qwx_ioe_exit);
 
 /* === Ciere de documentacion ================================================================== */
 /** @} Final de la definición del modulo para doxygen */
@@ -0,0 +1,178 @@
+/* Copyright 2021, Esteban Volentini - Facet UNT, FiUBA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file qwx_ioe_trace.h
+ **
+ ** @brief Puntos de traza del driver para la placa QWXIOE
+ **
+ ** Definiciones de los eventos de traza para medir con perf o trace-cmd el tiempo de las
+ ** transacciones en el bus, la deteccion de tarjetas y los cambios en las salidas.
+ **
+ ** @addtogroup plataforma
+ ** @{
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM qwx_ioe
+
+#if !defined(QWX_IOE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define QWX_IOE_TRACE_H
+
+/* === Inclusiones de cabeceras ================================================================ */
+
+#include <linux/tracepoint.h>
+
+/* === Definiciones de eventos de traza ======================================================== */
+
+//! Clase de eventos para las transacciones de lectura o escritura de registros de la placa
+DECLARE_EVENT_CLASS(qwxioe_register,
+    TP_PROTO(int board, unsigned char address, size_t length, int result, s64 duration),
+    TP_ARGS(board, address, length, result, duration),
+    TP_STRUCT__entry(
+        __field(int, board)
+        __field(unsigned char, address)
+        __field(size_t, length)
+        __field(int, result)
+        __field(s64, duration)
+    ),
+    TP_fast_assign(
+        __entry->board = board;
+        __entry->address = address;
+        __entry->length = length;
+        __entry->result = result;
+        __entry->duration = duration;
+    ),
+    TP_printk("exp%d address=0x%02x length=%zu result=%d duration=%lldns",
+        __entry->board, __entry->address, __entry->length, __entry->result, __entry->duration)
+);
+
+//! Evento de lectura de un bloque de registros de la placa
+DEFINE_EVENT(qwxioe_register, qwxioe_register_read,
+    TP_PROTO(int board, unsigned char address, size_t length, int result, s64 duration),
+    TP_ARGS(board, address, length, result, duration)
+);
+
+//! Evento de escritura de un bloque de registros de salidas de la placa
+DEFINE_EVENT(qwxioe_register, qwxioe_register_write,
+    TP_PROTO(int board, unsigned char address, size_t length, int result, s64 duration),
+    TP_ARGS(board, address, length, result, duration)
+);
+
+//! Evento de tarjeta decodificada en una lectora
+TRACE_EVENT(qwxioe_card,
+    TP_PROTO(int board, int reader, uint card_number, uint sequence, int access),
+    TP_ARGS(board, reader, card_number, sequence, access),
+    TP_STRUCT__entry(
+        __field(int, board)
+        __field(int, reader)
+        __field(uint, card_number)
+        __field(uint, sequence)
+        __field(int, access)
+    ),
+    TP_fast_assign(
+        __entry->board = board;
+        __entry->reader = reader;
+        __entry->card_number = card_number;
+        __entry->sequence = sequence;
+        __entry->access = access;
+    ),
+    TP_printk("exp%d/w%d card=%u sequence=%u access=%d",
+        __entry->board, __entry->reader, __entry->card_number, __entry->sequence, __entry->access)
+);
+
+//! Evento de cambio de estado de una salida
+TRACE_EVENT(qwxioe_output,
+    TP_PROTO(int board, int output, bool state),
+    TP_ARGS(board, output, state),
+    TP_STRUCT__entry(
+        __field(int, board)
+        __field(int, output)
+        __field(bool, state)
+    ),
+    TP_fast_assign(
+        __entry->board = board;
+        __entry->output = output;
+        __entry->state = state;
+    ),
+    TP_printk("exp%d/s%d state=%d", __entry->board, __entry->output, __entry->state)
+);
+
+//! Evento de inicio de un pulso en una salida
+TRACE_EVENT(qwxioe_output_pulse,
+    TP_PROTO(int board, int output, uint duration),
+    TP_ARGS(board, output, duration),
+    TP_STRUCT__entry(
+        __field(int, board)
+        __field(int, output)
+        __field(uint, duration)
+    ),
+    TP_fast_assign(
+        __entry->board = board;
+        __entry->output = output;
+        __entry->duration = duration;
+    ),
+    TP_printk("exp%d/s%d duration=%ums", __entry->board, __entry->output, __entry->duration)
+);
+
+//! Evento de actuacion de una salida en respuesta a una tarjeta, con la latencia desde la deteccion
+TRACE_EVENT(qwxioe_actuation,
+    TP_PROTO(int board, int output, int reader, uint sequence, s64 latency),
+    TP_ARGS(board, output, reader, sequence, latency),
+    TP_STRUCT__entry(
+        __field(int, board)
+        __field(int, output)
+        __field(int, reader)
+        __field(uint, sequence)
+        __field(s64, latency)
+    ),
+    TP_fast_assign(
+        __entry->board = board;
+        __entry->output = output;
+        __entry->reader = reader;
+        __entry->sequence = sequence;
+        __entry->latency = latency;
+    ),
+    TP_printk("exp%d/s%d reader=w%d sequence=%u latency=%lldns",
+        __entry->board, __entry->output, __entry->reader, __entry->sequence, __entry->latency)
+);
+
+/* === Ciere de documentacion ================================================================== */
+
+/** @} Final de la definición del modulo para doxygen */
+
+#endif /* QWX_IOE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE qwx_ioe_trace
+
+#include <trace/define_trace.h>